@@ -0,0 +1,420 @@
+#include "cli.h"
+#include "validator.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCollator>
+#include <QFileInfo>
+#include <QDir>
+#include <algorithm>
+#include <cstdio>
+
+// Keep the prober this many files ahead of the input, and no further.
+static const int FEED_LOW_WATER = 1024;
+// Lines read from stdin at a time.
+static const int FEED_BATCH = 256;
+
+
+cli::cli(QObject *parent) :
+    QObject(parent), out(stdout), err(stderr), failed(false), input(NULL),
+    inputDone(true), walking(false), feeding(false), exiting(false), added(0)
+{
+    connect(&store, SIGNAL(writeFailed(QString,storage::storeReturns)), SLOT(storage_writeFailed(QString,storage::storeReturns)));
+    connect(&probes, SIGNAL(accepted(QStringList)), SLOT(probes_accepted(QStringList)));
+    connect(&probes, SIGNAL(progress(int,int)), SLOT(feed()));
+    connect(&probes, SIGNAL(finished()), SLOT(feed()));
+    connect(&walker, SIGNAL(found(QStringList,int)), SLOT(walker_found(QStringList,int)));
+    connect(&walker, SIGNAL(finished()), SLOT(walker_finished()));
+}
+
+void cli::start()
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(tr("Looks after mplaylist's playlists without the gui."));
+    parser.addHelpOption();
+    QCommandLineOption playlistOption(QStringList() << "p" << "playlist",
+                                      tr("A playlist to work on.  May be given more than once."),
+                                      tr("title"));
+    QCommandLineOption allOption("all", tr("Work on every playlist."));
+    QCommandLineOption pruneOption("prune", tr("Have validate remove the entries it finds missing."));
+    parser.addOption(playlistOption);
+    parser.addOption(allOption);
+    parser.addOption(pruneOption);
+    parser.addPositionalArgument("command", tr("One of list, add, remove, dedupe, validate, sort or export."));
+    parser.addPositionalArgument("arguments", tr("Files or folders for add and remove (- reads them "
+                                                 "from stdin), or a directory for export."),
+                                 "[arguments...]");
+    if (!parser.parse(QCoreApplication::arguments())) {
+        err << parser.errorText() << Qt::endl;
+        finish(ecUsage);
+        return;
+    }
+    if (parser.isSet("help")) {
+        out << parser.helpText();
+        finish(ecSuccess);
+        return;
+    }
+    QStringList arguments = parser.positionalArguments();
+    if (arguments.isEmpty()) {
+        err << parser.helpText();
+        finish(ecUsage);
+        return;
+    }
+
+    QString command = arguments.takeFirst();
+    QStringList titles = parser.isSet(allOption) ? store.listPlaylists()
+                                                 : parser.values(playlistOption);
+    if (titles.isEmpty() && command != "list") {
+        err << tr("No playlists given; use -p or --all.") << Qt::endl;
+        finish(ecUsage);
+        return;
+    }
+    int status = ecUsage;
+    if (command == "list")
+        status = list();
+    else if (command == "add")
+        status = add(titles, arguments);
+    else if (command == "remove")
+        status = remove(titles, arguments);
+    else if (command == "dedupe")
+        status = dedupe(titles);
+    else if (command == "validate")
+        status = validate(titles, parser.isSet(pruneOption));
+    else if (command == "sort")
+        status = sort(titles);
+    else if (command == "export" && arguments.count() == 1)
+        status = exportTo(titles, arguments.first());
+    else if (command == "export")
+        err << tr("export needs a directory to write to.") << Qt::endl;
+    else
+        err << tr("Don't know how to %1.").arg(command) << Qt::endl;
+    // Adding carries on in the event loop, and finishes by itself.
+    if (status >= 0)
+        finish(status);
+}
+
+void cli::storage_writeFailed(const QString &name, storage::storeReturns why)
+{
+    fail(why, name);
+}
+
+int cli::list()
+{
+    foreach (const QString &title, store.listPlaylists()) {
+        QStringList entries;
+        if (peek(title, entries))
+            out << title << '\t' << entries.count() << '\n';
+    }
+    return ecSuccess;
+}
+
+int cli::add(const QStringList &titles, const QStringList &paths)
+{
+    if (titles.count() != 1) {
+        err << tr("Files can only be added to one playlist at a time.") << Qt::endl;
+        return ecUsage;
+    }
+    title = titles.first();
+    storage::storeReturns ret = store.readPlaylist(title, entries);
+    if (ret == storage::srNoLongerExists)
+        ret = store.addPlaylist(title);
+    if (ret != storage::srSuccess) {
+        fail(ret, title);
+        return ecFailed;
+    }
+    queued = QSet<QString>(entries.begin(), entries.end());
+
+    // Same as the gui: files go straight to the prober, folders to the
+    // walker first.
+    QStringList files;
+    QStringList directories;
+    foreach (const QString &path, paths) {
+        QFileInfo info(path);
+        if (path == "-") {
+            if (!input)
+                input = new QTextStream(stdin);
+            inputDone = false;
+        } else if (info.isDir()) {
+            directories.append(info.absoluteFilePath());
+        } else {
+            files.append(info.absoluteFilePath());
+        }
+    }
+    probes.probe(notQueued(files));
+    if (!directories.isEmpty()) {
+        walking = true;
+        walker.walk(directories);
+    }
+    feed();
+    return -1;
+}
+
+int cli::remove(const QStringList &titles, const QStringList &paths)
+{
+    QSet<QString> doomed;
+    foreach (const QString &path, paths) {
+        if (path != "-") {
+            doomed.insert(QFileInfo(path).absoluteFilePath());
+            continue;
+        }
+        QTextStream in(stdin);
+        QString line;
+        while (!(line = in.readLine()).isNull()) {
+            if (!line.isEmpty())
+                doomed.insert(QFileInfo(line).absoluteFilePath());
+        }
+    }
+
+    foreach (const QString &title, titles) {
+        QStringList entries;
+        if (!read(title, entries))
+            continue;
+        QList<int> indexes;
+        for (int i = 0; i < entries.count(); i++) {
+            if (doomed.contains(entries.at(i)))
+                indexes.append(i);
+        }
+        if (removeIndexes(title, indexes, entries))
+            out << tr("%1: removed %2").arg(title).arg(indexes.count()) << '\n';
+    }
+    return failed ? ecFailed : ecSuccess;
+}
+
+int cli::dedupe(const QStringList &titles)
+{
+    foreach (const QString &title, titles) {
+        QStringList entries;
+        if (!read(title, entries))
+            continue;
+        // The first of each stays where it is.
+        QSet<QString> seen;
+        QList<int> indexes;
+        for (int i = 0; i < entries.count(); i++) {
+            if (seen.contains(entries.at(i)))
+                indexes.append(i);
+            else
+                seen.insert(entries.at(i));
+        }
+        if (removeIndexes(title, indexes, entries))
+            out << tr("%1: removed %2 duplicates").arg(title).arg(indexes.count()) << '\n';
+    }
+    return failed ? ecFailed : ecSuccess;
+}
+
+int cli::validate(const QStringList &titles, bool prune)
+{
+    foreach (const QString &title, titles) {
+        QStringList entries;
+        if (!(prune ? read(title, entries) : peek(title, entries)))
+            continue;
+        QStringList missingList = validator::missingEntries(entries);
+        QSet<QString> missing(missingList.begin(), missingList.end());
+        QList<int> indexes;
+        for (int i = 0; i < entries.count(); i++) {
+            if (!missing.contains(entries.at(i)))
+                continue;
+            indexes.append(i);
+            out << title << '\t' << entries.at(i) << '\n';
+        }
+        if (prune)
+            removeIndexes(title, indexes, entries);
+    }
+    return failed ? ecFailed : ecSuccess;
+}
+
+int cli::sort(const QStringList &titles)
+{
+    // The order the walker finds things in, so a sorted playlist looks the
+    // same as one that was dropped in as a folder.
+    QCollator collator;
+    collator.setNumericMode(true);
+    collator.setCaseSensitivity(Qt::CaseInsensitive);
+    foreach (const QString &title, titles) {
+        QStringList entries;
+        if (!read(title, entries))
+            continue;
+        QStringList sorted = entries;
+        std::stable_sort(sorted.begin(), sorted.end(), collator);
+        if (sorted == entries)
+            continue;
+        storage::storeReturns ret = store.updatePlaylist(title, sorted);
+        if (ret != storage::srSuccess)
+            fail(ret, title);
+    }
+    return failed ? ecFailed : ecSuccess;
+}
+
+int cli::exportTo(const QStringList &titles, const QString &directory)
+{
+    QDir dir(directory);
+    if (!dir.mkpath(".")) {
+        fail(storage::srWriteFailed, directory);
+        return ecFailed;
+    }
+    foreach (const QString &title, titles) {
+        QStringList entries;
+        if (!peek(title, entries))
+            continue;
+        storage::storeReturns ret = store.exportPlaylist(dir.filePath(title + ".m3u"), entries);
+        if (ret != storage::srSuccess)
+            fail(ret, title);
+    }
+    return failed ? ecFailed : ecSuccess;
+}
+
+void cli::walker_found(const QStringList &files, int walk)
+{
+    (void)walk;  // we never cancel, so every walk is ours
+    probes.probe(notQueued(files));
+    feed();
+}
+
+void cli::walker_finished()
+{
+    // It may have been given more while it was on its way out.
+    walking = walker.isBusy();
+    feed();
+}
+
+void cli::probes_accepted(const QStringList &files)
+{
+    entries.append(files);
+    added += files.count();
+    storage::storeReturns ret = store.appendEntries(title, files);
+    if (ret != storage::srSuccess)
+        fail(ret, title);
+}
+
+void cli::feed()
+{
+    // Called again from inside probes.probe() when everything it was given
+    // is already in the probe cache, which would otherwise recurse once for
+    // every batch read.
+    if (feeding || exiting)
+        return;
+    feeding = true;
+    while (!inputDone && probes.pending() < FEED_LOW_WATER) {
+        QStringList files;
+        QStringList directories;
+        while (files.count() < FEED_BATCH) {
+            QString line = input->readLine();
+            if (line.isNull()) {
+                inputDone = true;
+                break;
+            }
+            if (line.isEmpty())
+                continue;
+            QFileInfo info(line);
+            if (info.isDir())
+                directories.append(info.absoluteFilePath());
+            else
+                files.append(info.absoluteFilePath());
+        }
+        probes.probe(notQueued(files));
+        if (!directories.isEmpty()) {
+            walking = true;
+            walker.walk(directories);
+        }
+    }
+    if (walking && probes.pending() < FEED_LOW_WATER)
+        walker.proceed();
+    feeding = false;
+
+    if (inputDone && !walking && !probes.isBusy()) {
+        out << tr("%1: added %2").arg(title).arg(added) << '\n';
+        finish(failed ? ecFailed : ecSuccess);
+    }
+}
+
+bool cli::read(const QString &title, QStringList &entries)
+{
+    storage::storeReturns ret = store.readPlaylist(title, entries);
+    if (ret != storage::srSuccess) {
+        fail(ret, title);
+        return false;
+    }
+    return true;
+}
+
+bool cli::peek(const QString &title, QStringList &entries)
+{
+    storage::storeReturns ret = store.peekPlaylist(title, entries);
+    if (ret != storage::srSuccess) {
+        fail(ret, title);
+        return false;
+    }
+    return true;
+}
+
+bool cli::removeIndexes(const QString &title, const QList<int> &indexes, QStringList &entries)
+{
+    if (indexes.isEmpty())
+        return true;
+    for (int i = indexes.count() - 1; i >= 0; i--)
+        entries.removeAt(indexes.at(i));
+    storage::storeReturns ret = store.removeEntries(title, indexes);
+    if (ret != storage::srSuccess) {
+        fail(ret, title);
+        return false;
+    }
+    return true;
+}
+
+QStringList cli::notQueued(const QStringList &files)
+{
+    // Anything already in the playlist, or already on its way, is skipped.
+    // A file that fails its probe stays skipped too, which is no loss.
+    QStringList fresh;
+    foreach (const QString &file, files) {
+        if (queued.contains(file))
+            continue;
+        queued.insert(file);
+        fresh.append(file);
+    }
+    return fresh;
+}
+
+void cli::finish(int status)
+{
+    if (exiting)
+        return;
+    exiting = true;
+    // Make sure it all made it to the disk before we say it did.
+    store.flush();
+    QCoreApplication::processEvents();
+    if (failed && status == ecSuccess)
+        status = ecFailed;
+    out.flush();
+    err.flush();
+    delete input;
+    input = NULL;
+    QCoreApplication::exit(status);
+}
+
+void cli::fail(storage::storeReturns why, const QString &name)
+{
+    if (why == storage::srSuccess)
+        return;
+    failed = true;
+    switch (why) {
+    case storage::srAlreadyExists:
+        err << tr("%1: already exists").arg(name) << Qt::endl;
+        break;
+    case storage::srNoLongerExists:
+        err << tr("%1: no such playlist").arg(name) << Qt::endl;
+        break;
+    case storage::srWriteFailed:
+        err << tr("%1: could not be written").arg(name) << Qt::endl;
+        break;
+    case storage::srReadFailed:
+        err << tr("%1: could not be read").arg(name) << Qt::endl;
+        break;
+    case storage::srRenameFailed:
+        err << tr("%1: could not be renamed").arg(name) << Qt::endl;
+        break;
+    case storage::srRemoveFailed:
+        err << tr("%1: could not be removed").arg(name) << Qt::endl;
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <QObject>
+#include <QStringList>
+#include <QSet>
+#include <QTextStream>
+#include "storage.h"
+#include "prober.h"
+#include "dirwalker.h"
+
+/* Looking after a hundred playlists from a nightly job shouldn't need a
+ * display.  This is what mplaylist-cli runs: the same storage, walker and
+ * prober the gui uses, against QtCore alone, so it reads and writes the
+ * playlists exactly as the gui does.  list, export and validate without
+ * --prune only look, and leave the files alone.
+ *
+ * The two take turns writing a playlist's files, but that is all.  A
+ * running gui only reloads a playlist when its directory watcher notices the
+ * change, and anything it journals in the meantime is by index, against
+ * the list as it had it.  Best not to edit the same playlist from both at
+ * once.
+ *
+ *     mplaylist-cli list
+ *     mplaylist-cli add -p <title> <files or folders, - for stdin...>
+ *     mplaylist-cli remove [-p <title>...|--all] <files, - for stdin...>
+ *     mplaylist-cli dedupe [-p <title>...|--all]
+ *     mplaylist-cli validate [--prune] [-p <title>...|--all]
+ *     mplaylist-cli sort [-p <title>...|--all]
+ *     mplaylist-cli export [-p <title>...|--all] <directory>
+ *
+ * Adding streams: paths are read from stdin and folders walked a batch at a
+ * time, and only as fast as the prober (which runs its probes in parallel)
+ * keeps up, so piping in a whole library doesn't all end up in memory at
+ * once.  Whatever passes is appended as it comes, in the order it was given.
+ * Removals are journaled, as they are in the gui; sorting rewrites.
+ */
+
+class cli : public QObject
+{
+    Q_OBJECT
+public:
+    explicit cli(QObject *parent = 0);
+
+    // Status codes for the shell.
+    enum exitCodes { ecSuccess, ecFailed, ecUsage };
+
+public slots:
+    // Works out what to do from the application's arguments, and quits the
+    // application with one of the above once it is done.
+    void start();
+
+private slots:
+    void storage_writeFailed(const QString &name, storage::storeReturns why);
+    void walker_found(const QStringList &files, int walk);
+    void walker_finished();
+    void probes_accepted(const QStringList &files);
+    void feed();
+
+private:
+    storage store;
+    prober probes;
+    dirwalker walker;
+    QTextStream out;
+    QTextStream err;
+    bool failed;
+
+    // Where an add is up to.
+    QString title;
+    QStringList entries;
+    QSet<QString> queued;
+    QTextStream *input;
+    bool inputDone;
+    bool walking;
+    bool feeding;
+    bool exiting;
+    int added;
+
+    int list();
+    int add(const QStringList &titles, const QStringList &paths);
+    int remove(const QStringList &titles, const QStringList &paths);
+    int dedupe(const QStringList &titles);
+    int validate(const QStringList &titles, bool prune);
+    int sort(const QStringList &titles);
+    int exportTo(const QStringList &titles, const QString &directory);
+
+    bool read(const QString &title, QStringList &entries);
+    // For commands that only look, and shouldn't fold any journal.
+    bool peek(const QString &title, QStringList &entries);
+    bool removeIndexes(const QString &title, const QList<int> &indexes, QStringList &entries);
+    QStringList notQueued(const QStringList &files);
+    void finish(int status);
+    void fail(storage::storeReturns why, const QString &name);
+};
+
+#endif // CLI_H
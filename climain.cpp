@@ -0,0 +1,18 @@
+#include "cli.h"
+#include "tracer.h"
+#include <QCoreApplication>
+#include <QTimer>
+
+int main(int argc, char *argv[])
+{
+    // The same names as the gui, so we find the same playlists.
+    QCoreApplication::setOrganizationDomain("github.cmdrkotori.mplaylist");
+    QCoreApplication::setOrganizationName("mplaylist");
+    QCoreApplication::setApplicationName("mplaylist");
+    QCoreApplication a(argc, argv);
+    TRACE_INSTANT("main");
+    cli engine;
+    QTimer::singleShot(0, &engine, SLOT(start()));
+
+    return a.exec();
+}
@@ -0,0 +1,175 @@
+#include "dirwalker.h"
+#include "tracer.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QCollator>
+#include <QElapsedTimer>
+#include <QSet>
+#include <algorithm>
+
+// Files per batch, and how long to sit on a smaller batch, in milliseconds,
+// before handing it out anyway.
+static const int BATCH_SIZE = 256;
+static const int BATCH_DELAY = 100;
+// How many batches may be handed out without anyone asking for more.
+static const int MAX_CREDITS = 2;
+
+struct naturalOrder
+{
+    naturalOrder(const QCollator &collator) : collator(collator) {}
+    bool operator()(const QString &a, const QString &b) const
+    {
+        return collator.compare(a, b) < 0;
+    }
+    const QCollator &collator;
+};
+
+dirwalker::dirwalker(QObject *parent) :
+    QThread(parent), walkNumber(0), credits(MAX_CREDITS), running(false)
+{
+}
+
+dirwalker::~dirwalker()
+{
+    cancel();
+    wait();
+}
+
+void dirwalker::walk(const QStringList &directories)
+{
+    QMutexLocker lock(&mutex);
+    roots.append(directories);
+    if (running)
+        return;
+    running = true;
+    lock.unlock();
+    // If we only just ran out of work, the thread may still be on its way
+    // out, and start() doesn't do anything until it's gone.
+    wait();
+    start(QThread::LowPriority);
+}
+
+void dirwalker::proceed()
+{
+    QMutexLocker lock(&mutex);
+    if (credits < MAX_CREDITS)
+        credits++;
+    wakeUp.wakeAll();
+}
+
+void dirwalker::cancel()
+{
+    QMutexLocker lock(&mutex);
+    walkNumber++;
+    roots.clear();
+    credits = MAX_CREDITS;
+    wakeUp.wakeAll();
+}
+
+bool dirwalker::isBusy()
+{
+    QMutexLocker lock(&mutex);
+    return running;
+}
+
+int dirwalker::currentWalk()
+{
+    QMutexLocker lock(&mutex);
+    return walkNumber;
+}
+
+void dirwalker::run()
+{
+    forever {
+        QString root;
+        int walk;
+        {
+            QMutexLocker lock(&mutex);
+            if (roots.isEmpty()) {
+                running = false;
+                return;
+            }
+            root = roots.takeFirst();
+            walk = walkNumber;
+        }
+        walkTree(root, walk);
+    }
+}
+
+bool dirwalker::walkTree(const QString &root, int walk)
+{
+    TRACE_SCOPE("dirwalker::walkTree", root);
+    // Each QCollator is only good for one thread, so this one is ours.
+    QCollator collator;
+    collator.setNumericMode(true);
+    collator.setCaseSensitivity(Qt::CaseInsensitive);
+    naturalOrder order(collator);
+
+    // A depth first walk, keeping for each level only the subdirectories
+    // still to be visited.  Symlinks are followed, but no directory is
+    // walked twice, so loops don't go on forever.
+    QList<QStringList> pending;
+    pending.append(QStringList() << root);
+    QSet<QString> visited;
+    QStringList batch;
+    QElapsedTimer sinceHanded;
+    sinceHanded.start();
+    while (!pending.isEmpty()) {
+        if (pending.last().isEmpty()) {
+            pending.removeLast();
+            continue;
+        }
+        QString path = pending.last().takeFirst();
+        QString canonical = QFileInfo(path).canonicalFilePath();
+        if (canonical.isEmpty() || visited.contains(canonical))
+            continue;
+        visited.insert(canonical);
+
+        QDir dir(path);
+        QStringList files = dir.entryList(QDir::Files | QDir::Readable);
+        QStringList subdirs = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        std::sort(files.begin(), files.end(), order);
+        std::sort(subdirs.begin(), subdirs.end(), order);
+        foreach (const QString &file, files) {
+            batch.append(dir.filePath(file));
+            if (batch.count() >= BATCH_SIZE) {
+                if (!hand(batch, walk))
+                    return false;
+                sinceHanded.restart();
+            }
+        }
+        if (!batch.isEmpty() && sinceHanded.elapsed() >= BATCH_DELAY) {
+            if (!hand(batch, walk))
+                return false;
+            sinceHanded.restart();
+        }
+        if (cancelled(walk))
+            return false;
+        QStringList children;
+        foreach (const QString &subdir, subdirs)
+            children.append(dir.filePath(subdir));
+        pending.append(children);
+    }
+    return batch.isEmpty() || hand(batch, walk);
+}
+
+bool dirwalker::hand(QStringList &batch, int walk)
+{
+    {
+        QMutexLocker lock(&mutex);
+        while (credits <= 0 && walk == walkNumber)
+            wakeUp.wait(&mutex);
+        if (walk != walkNumber)
+            return false;
+        credits--;
+    }
+    emit found(batch, walk);
+    batch.clear();
+    return true;
+}
+
+bool dirwalker::cancelled(int walk)
+{
+    QMutexLocker lock(&mutex);
+    return walk != walkNumber;
+}
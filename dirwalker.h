@@ -0,0 +1,59 @@
+#ifndef DIRWALKER_H
+#define DIRWALKER_H
+
+#include <QThread>
+#include <QStringList>
+#include <QMutex>
+#include <QWaitCondition>
+
+/* Dropping a whole music library on a playlist means a walk over a hundred
+ * thousand files, which is not something to do on the gui thread, or all
+ * before anything gets added.  This thread walks the directories it's given
+ * in natural order (track 2 before track 10), the files in a directory
+ * first and then its subdirectories, and hands out what it finds in batches
+ * as it goes.
+ *
+ * So that it can't get arbitrarily far ahead of whoever is checking the
+ * files, it only hands out a batch when it has been told to proceed(), and
+ * then waits for the next go-ahead.  A couple of batches are allowed up
+ * front to get things going.
+ *
+ * Cancelling starts a new walk, as far as anyone listening is concerned:
+ * batches carry the number of the walk they belong to, so any stragglers
+ * from a cancelled one can be told apart and ignored.
+ */
+
+class dirwalker : public QThread
+{
+    Q_OBJECT
+public:
+    explicit dirwalker(QObject *parent = 0);
+    ~dirwalker();
+
+    // Directories given while a walk is going are walked after it.
+    void walk(const QStringList &directories);
+    void proceed();
+    void cancel();
+    bool isBusy();
+    int currentWalk();
+
+signals:
+    void found(const QStringList &files, int walk);
+
+protected:
+    void run();
+
+private:
+    QMutex mutex;
+    QWaitCondition wakeUp;
+    QStringList roots;
+    int walkNumber;
+    int credits;
+    bool running;
+
+    bool walkTree(const QString &root, int walk);
+    bool hand(QStringList &batch, int walk);
+    bool cancelled(int walk);
+};
+
+#endif // DIRWALKER_H
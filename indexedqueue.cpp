@@ -0,0 +1,336 @@
+#include "indexedqueue.h"
+#include <QVector>
+#include <algorithm>
+
+indexedqueue::indexedqueue() :
+    root(NULL), seed(2463534242u)
+{
+}
+
+indexedqueue::~indexedqueue()
+{
+    clear();
+}
+
+void indexedqueue::setList(const QStringList &list)
+{
+    clear();
+    QVector<node*> order;
+    order.reserve(list.count());
+    foreach (const QString &path, list)
+        order.append(newNode(path));
+    rebuild(order);
+}
+
+void indexedqueue::removeAll(const QList<int> &indexes)
+{
+    QVector<node*> order = nodes();
+    foreach (int position, indexes) {
+        node *n = order.at(position);
+        index.remove(n->path, n);
+        delete n;
+        order[position] = NULL;
+    }
+    order.erase(std::remove(order.begin(), order.end(), (node*)NULL), order.end());
+    rebuild(order);
+}
+
+void indexedqueue::permute(const QVector<int> &from)
+{
+    QVector<node*> old = nodes();
+    QVector<node*> order;
+    order.reserve(old.count());
+    foreach (int position, from)
+        order.append(old.at(position));
+    rebuild(order);
+}
+
+void indexedqueue::rebuild(const QVector<node*> &order)
+{
+    // Build the treap in one pass, the way you'd build a cartesian tree:
+    // the right spine is kept on a stack, and each new node adopts whatever
+    // it outranks from the bottom of it as its left child.
+    root = NULL;
+    QVector<node*> spine;
+    foreach (node *n, order) {
+        n->left = n->right = n->parent = NULL;
+        node *last = NULL;
+        while (!spine.isEmpty() && spine.last()->priority < n->priority) {
+            last = spine.last();
+            spine.removeLast();
+            update(last);
+        }
+        n->left = last;
+        if (last)
+            last->parent = n;
+        if (!spine.isEmpty()) {
+            spine.last()->right = n;
+            n->parent = spine.last();
+        }
+        spine.append(n);
+    }
+    // What's left of the spine needs its sizes worked out from the bottom
+    // up, and the top of the tree is at the bottom of the stack.
+    if (!spine.isEmpty())
+        root = spine.first();
+    while (!spine.isEmpty()) {
+        update(spine.last());
+        spine.removeLast();
+    }
+}
+
+QStringList indexedqueue::toList() const
+{
+    patharena *arena = patharena::instance();
+    QStringList flat;
+    flat.reserve(count());
+    foreach (patharena::handle file, handles())
+        flat.append(arena->path(file));
+    return flat;
+}
+
+QVector<patharena::handle> indexedqueue::handles() const
+{
+    QVector<patharena::handle> flat;
+    flat.reserve(count());
+    foreach (const node *n, nodes())
+        flat.append(n->path);
+    return flat;
+}
+
+QVector<indexedqueue::node*> indexedqueue::nodes() const
+{
+    QVector<node*> flat;
+    flat.reserve(count());
+    QVector<node*> stack;
+    node *n = root;
+    while (n || !stack.isEmpty()) {
+        while (n) {
+            stack.append(n);
+            n = n->left;
+        }
+        n = stack.last();
+        stack.removeLast();
+        flat.append(n);
+        n = n->right;
+    }
+    return flat;
+}
+
+int indexedqueue::count() const
+{
+    return sizeOf(root);
+}
+
+bool indexedqueue::isEmpty() const
+{
+    return root == NULL;
+}
+
+QString indexedqueue::at(int index) const
+{
+    return patharena::instance()->path(nodeAt(root, index)->path);
+}
+
+QString indexedqueue::fileNameAt(int index) const
+{
+    return patharena::instance()->fileName(nodeAt(root, index)->path);
+}
+
+patharena::handle indexedqueue::handleAt(int index) const
+{
+    return nodeAt(root, index)->path;
+}
+
+bool indexedqueue::contains(const QString &path) const
+{
+    patharena::handle handle;
+    return patharena::instance()->find(path, handle) && index.contains(handle);
+}
+
+QList<int> indexedqueue::indexesOf(const QString &path) const
+{
+    patharena::handle handle;
+    if (!patharena::instance()->find(path, handle))
+        return QList<int>();
+    return indexesOf(handle);
+}
+
+QList<int> indexedqueue::indexesOf(patharena::handle file) const
+{
+    QList<int> positions;
+    QMultiHash<patharena::handle, node*>::const_iterator i = index.constFind(file);
+    for (; i != index.constEnd() && i.key() == file; ++i)
+        positions.append(positionOf(i.value()));
+    std::sort(positions.begin(), positions.end());
+    return positions;
+}
+
+void indexedqueue::insert(int index, const QString &path)
+{
+    put(index, newNode(path));
+}
+
+void indexedqueue::append(const QString &path)
+{
+    put(count(), newNode(path));
+}
+
+void indexedqueue::removeAt(int position)
+{
+    node *n = take(position);
+    index.remove(n->path, n);
+    delete n;
+}
+
+void indexedqueue::move(int from, int to)
+{
+    if (from == to)
+        return;
+    put(to, take(from));
+}
+
+void indexedqueue::clear()
+{
+    // Iteratively, so a degenerate tree can't blow the stack.
+    QVector<node*> stack;
+    if (root)
+        stack.append(root);
+    while (!stack.isEmpty()) {
+        node *n = stack.last();
+        stack.removeLast();
+        if (n->left)
+            stack.append(n->left);
+        if (n->right)
+            stack.append(n->right);
+        delete n;
+    }
+    root = NULL;
+    index.clear();
+}
+
+quint32 indexedqueue::nextPriority()
+{
+    // xorshift32; we only need the priorities to be unpredictable by the
+    // order of the playlist, not by anyone trying.
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+indexedqueue::node *indexedqueue::newNode(const QString &path)
+{
+    node *n = new node;
+    n->path = patharena::instance()->intern(path);
+    n->left = n->right = n->parent = NULL;
+    n->priority = nextPriority();
+    n->size = 1;
+    index.insert(n->path, n);
+    return n;
+}
+
+indexedqueue::node *indexedqueue::take(int position)
+{
+    node *left, *middle, *right;
+    split(root, position, left, middle);
+    split(middle, 1, middle, right);
+    root = merge(left, right);
+    if (root)
+        root->parent = NULL;
+    middle->parent = NULL;
+    return middle;
+}
+
+void indexedqueue::put(int position, node *n)
+{
+    node *left, *right;
+    n->left = n->right = n->parent = NULL;
+    n->size = 1;
+    split(root, position, left, right);
+    root = merge(merge(left, n), right);
+    root->parent = NULL;
+}
+
+int indexedqueue::sizeOf(const node *n)
+{
+    return n ? n->size : 0;
+}
+
+void indexedqueue::update(node *n)
+{
+    n->size = 1 + sizeOf(n->left) + sizeOf(n->right);
+    if (n->left)
+        n->left->parent = n;
+    if (n->right)
+        n->right->parent = n;
+}
+
+void indexedqueue::split(node *t, int count, node *&left, node *&right)
+{
+    // The first count entries of t end up in left, the rest in right.
+    if (!t) {
+        left = right = NULL;
+        return;
+    }
+    if (sizeOf(t->left) < count) {
+        node *rest;
+        split(t->right, count - sizeOf(t->left) - 1, t->right, rest);
+        update(t);
+        left = t;
+        right = rest;
+    } else {
+        node *rest;
+        split(t->left, count, rest, t->left);
+        update(t);
+        left = rest;
+        right = t;
+    }
+    if (left)
+        left->parent = NULL;
+    if (right)
+        right->parent = NULL;
+}
+
+indexedqueue::node *indexedqueue::merge(node *left, node *right)
+{
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+    if (left->priority > right->priority) {
+        left->right = merge(left->right, right);
+        update(left);
+        return left;
+    }
+    right->left = merge(left, right->left);
+    update(right);
+    return right;
+}
+
+indexedqueue::node *indexedqueue::nodeAt(node *t, int position)
+{
+    while (t) {
+        int leftSize = sizeOf(t->left);
+        if (position < leftSize) {
+            t = t->left;
+        } else if (position == leftSize) {
+            return t;
+        } else {
+            position -= leftSize + 1;
+            t = t->right;
+        }
+    }
+    return NULL;
+}
+
+int indexedqueue::positionOf(const node *n)
+{
+    int position = sizeOf(n->left);
+    while (n->parent) {
+        if (n == n->parent->right)
+            position += sizeOf(n->parent->left) + 1;
+        n = n->parent;
+    }
+    return position;
+}
@@ -0,0 +1,92 @@
+#ifndef INDEXEDQUEUE_H
+#define INDEXEDQUEUE_H
+
+#include <QString>
+#include <QStringList>
+#include <QMultiHash>
+#include <QList>
+#include <QVector>
+#include "patharena.h"
+
+/* A playlist as a list of paths, except that the things a playlist gets asked
+ * most (take this one out, move that one up, have we got this file already)
+ * don't have to walk or shift the whole thing.  The order lives in a treap
+ * keyed on position, where each node knows the size of its subtree, so
+ * finding, inserting or removing the nth entry is O(log n).  Alongside it, a
+ * hash from path to nodes answers "where is this file?" without looking at
+ * every entry, since each node can work out its own position from its
+ * parents.
+ *
+ * The paths themselves are kept as handles into the patharena, so a node is
+ * a few dozen bytes however long its path is.  Handing the whole queue to
+ * storage means flattening it and spelling the paths out again, which is
+ * O(n); the list isn't kept afterwards, since that would put back all the
+ * memory the arena saves.
+ */
+
+class indexedqueue
+{
+public:
+    indexedqueue();
+    ~indexedqueue();
+
+    void setList(const QStringList &list);
+    QStringList toList() const;
+
+    int count() const;
+    bool isEmpty() const;
+    QString at(int index) const;
+    QString fileNameAt(int index) const;
+    patharena::handle handleAt(int index) const;
+    QVector<patharena::handle> handles() const;
+    bool contains(const QString &path) const;
+    // Positions of every copy of path, lowest first.
+    QList<int> indexesOf(const QString &path) const;
+    QList<int> indexesOf(patharena::handle file) const;
+
+    void insert(int index, const QString &path);
+    void append(const QString &path);
+    void removeAt(int index);
+    void move(int from, int to);
+    void clear();
+
+    // Batches, in one O(n) pass each, rather than one O(log n) edit at a
+    // time.  removeAll takes positions as they are before any removal;
+    // permute takes, for each new position, the old position that goes
+    // there.
+    void removeAll(const QList<int> &indexes);
+    void permute(const QVector<int> &from);
+
+private:
+    struct node {
+        patharena::handle path;
+        node *left;
+        node *right;
+        node *parent;
+        quint32 priority;
+        int size;
+    };
+
+    node *root;
+    QMultiHash<patharena::handle, node*> index;
+    quint32 seed;
+
+    quint32 nextPriority();
+    node *newNode(const QString &path);
+    void rebuild(const QVector<node*> &order);
+    QVector<node*> nodes() const;
+    node *take(int position);
+    void put(int position, node *n);
+
+    static int sizeOf(const node *n);
+    static void update(node *n);
+    static void split(node *t, int count, node *&left, node *&right);
+    static node *merge(node *left, node *right);
+    static node *nodeAt(node *t, int position);
+    static int positionOf(const node *n);
+
+    indexedqueue(const indexedqueue &);
+    indexedqueue &operator=(const indexedqueue &);
+};
+
+#endif // INDEXEDQUEUE_H
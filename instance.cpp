@@ -0,0 +1,199 @@
+#include "instance.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QCryptographicHash>
+#include <QSettings>
+#include <QFileInfo>
+#include <QDir>
+#include <QStandardPaths>
+
+// How long to wait on a running copy, in milliseconds.  Connecting to a
+// socket nobody is listening on fails straight away, so this only matters
+// when somebody is there and slow to answer.
+static const int FORWARD_TIMEOUT = 1000;
+
+instance::instance(QObject *parent) :
+    QObject(parent)
+{
+    server = new QLocalServer(this);
+    // Only ourselves get to tell us what to do.
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(server, SIGNAL(newConnection()), SLOT(server_newConnection()));
+}
+
+QList<QJsonObject> instance::commandsFromArguments(const QStringList &arguments)
+{
+    bool understood;
+    return parseArguments(arguments, false, understood);
+}
+
+bool instance::commandsBeforeApplication(const QStringList &arguments, QList<QJsonObject> &commands)
+{
+    bool understood;
+    commands = parseArguments(arguments, true, understood);
+    return understood;
+}
+
+QList<QJsonObject> instance::parseArguments(const QStringList &arguments, bool early, bool &understood)
+{
+    QCommandLineParser parser;
+    // Qt's own options are single dash words, like -platform and -style.
+    // Taken as bundles of short options, -platform would be -p latform.
+    parser.setSingleDashWordOptionMode(QCommandLineParser::ParseAsLongOptions);
+    parser.setApplicationDescription(QCoreApplication::translate("instance",
+        "Plays playlists with mpv.  If mplaylist is already running, the "
+        "command is handed to it instead."));
+    parser.addHelpOption();
+    QCommandLineOption playlistOption(QStringList() << "p" << "playlist",
+        QCoreApplication::translate("instance", "The playlist to use, rather than the current one."),
+        QCoreApplication::translate("instance", "title"));
+    QCommandLineOption playOption("play", QCoreApplication::translate("instance", "Start playing."));
+    QCommandLineOption stopOption("stop", QCoreApplication::translate("instance", "Stop playing."));
+    QCommandLineOption focusOption("focus", QCoreApplication::translate("instance", "Bring the window to the front."));
+    parser.addOption(playlistOption);
+    parser.addOption(playOption);
+    parser.addOption(stopOption);
+    parser.addOption(focusOption);
+    parser.addPositionalArgument("files", QCoreApplication::translate("instance", "Files or folders to add."), "[files...]");
+    understood = true;
+    if (!early) {
+        parser.process(arguments);
+    } else if (!parser.parse(arguments)) {
+        // Most likely one of Qt's options, which the QApplication takes out
+        // of the arguments for us.
+        understood = false;
+        return QList<QJsonObject>();
+    } else if (parser.isSet("help")) {
+        parser.showHelp();
+    }
+
+    QString playlist = parser.value(playlistOption);
+    QList<QJsonObject> commands;
+    QJsonObject command;
+    if (!parser.positionalArguments().isEmpty()) {
+        QJsonArray files;
+        foreach (const QString &file, parser.positionalArguments())
+            files.append(QFileInfo(file).absoluteFilePath());
+        command.insert("command", QString("enqueue"));
+        command.insert("playlist", playlist);
+        command.insert("files", files);
+        commands.append(command);
+    }
+    if (parser.isSet(stopOption)) {
+        command = QJsonObject();
+        command.insert("command", QString("stop"));
+        command.insert("playlist", playlist);
+        commands.append(command);
+    }
+    if (parser.isSet(playOption)) {
+        command = QJsonObject();
+        command.insert("command", QString("play"));
+        command.insert("playlist", playlist);
+        commands.append(command);
+    }
+    if (parser.isSet(focusOption) || commands.isEmpty()) {
+        command = QJsonObject();
+        command.insert("command", QString("focus"));
+        commands.append(command);
+    }
+    return commands;
+}
+
+bool instance::forward(const QList<QJsonObject> &commands)
+{
+    QLocalSocket socket;
+    socket.connectToServer(serverName());
+    if (!socket.waitForConnected(FORWARD_TIMEOUT))
+        return false;
+    foreach (const QJsonObject &command, commands)
+        socket.write(QJsonDocument(command).toJson(QJsonDocument::Compact) + '\n');
+    if (!socket.waitForBytesWritten(FORWARD_TIMEOUT))
+        return false;
+    socket.disconnectFromServer();
+    if (socket.state() != QLocalSocket::UnconnectedState)
+        socket.waitForDisconnected(FORWARD_TIMEOUT);
+    return true;
+}
+
+bool instance::listen()
+{
+    if (server->listen(serverName()))
+        return true;
+    // A socket left over from a copy that crashed is still in the way.  If
+    // nobody answers on it, it is ours to take.
+    QLocalSocket socket;
+    socket.connectToServer(serverName());
+    if (socket.waitForConnected(FORWARD_TIMEOUT))
+        return false;
+    QLocalServer::removeServer(serverName());
+    return server->listen(serverName());
+}
+
+void instance::replay(const QList<QJsonObject> &commands)
+{
+    foreach (const QJsonObject &command, commands)
+        receive(QJsonDocument(command).toJson(QJsonDocument::Compact));
+}
+
+QString instance::serverName()
+{
+    // The same directory storage uses, worked out the same way.
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope,
+                       QCoreApplication::organizationName(),
+                       QCoreApplication::applicationName());
+    QString configPath = QFileInfo(settings.fileName()).absolutePath();
+    QString name = QCoreApplication::applicationName() + "-"
+            + QCryptographicHash::hash(configPath.toUtf8(), QCryptographicHash::Md5).toHex().left(16);
+#ifdef Q_OS_WIN
+    return name;
+#else
+    // A bare name would land in the shared temp directory, where anybody
+    // could guess it and get there first.  The runtime directory is ours
+    // alone.
+    QString runtimePath = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (runtimePath.isEmpty())
+        return name;
+    return QDir(runtimePath).filePath(name);
+#endif
+}
+
+void instance::server_newConnection()
+{
+    while (server->hasPendingConnections()) {
+        QLocalSocket *socket = server->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), SLOT(socket_readyRead()));
+        connect(socket, SIGNAL(disconnected()), SLOT(socket_disconnected()));
+    }
+}
+
+void instance::socket_readyRead()
+{
+    QLocalSocket *socket = static_cast<QLocalSocket*>(sender());
+    while (socket->canReadLine())
+        receive(socket->readLine().trimmed());
+}
+
+void instance::socket_disconnected()
+{
+    // Whoever it was says their piece and hangs up straight away, so there
+    // may be some left that we haven't seen yet.
+    QLocalSocket *socket = static_cast<QLocalSocket*>(sender());
+    while (socket->canReadLine())
+        receive(socket->readLine().trimmed());
+    socket->deleteLater();
+}
+
+void instance::receive(const QByteArray &line)
+{
+    QJsonObject command = QJsonDocument::fromJson(line).object();
+    QStringList files;
+    foreach (const QJsonValue &file, command.value("files").toArray())
+        files.append(file.toString());
+    QString name = command.value("command").toString();
+    if (!name.isEmpty())
+        emit commandReceived(name, command.value("playlist").toString(), files);
+}
@@ -0,0 +1,73 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include <QObject>
+#include <QStringList>
+#include <QJsonObject>
+#include <QList>
+
+class QLocalServer;
+class QLocalSocket;
+
+/* Launching us from a file manager or a script used to start a whole new
+ * copy, which then read every playlist and raced the copy already running
+ * over the same m3u files.  Now the first copy listens on a local socket,
+ * and later launches hand their command line over to it and leave.
+ *
+ * The socket is named after the config directory, so only copies that
+ * would share playlists find each other.  It lives in the user's runtime
+ * directory and only the user may connect to it.  Commands go over it as one JSON
+ * object per line:
+ *
+ *     {"command": "enqueue", "playlist": "...", "files": ["...", ...]}
+ *     {"command": "play", "playlist": "..."}
+ *     {"command": "stop", "playlist": "..."}
+ *     {"command": "focus"}
+ *
+ * An empty playlist means the current tab.  Files are made absolute before
+ * they are sent, as the other copy has its own working directory.
+ *
+ * Finding out whether somebody is listening is the whole point of starting
+ * quickly, so forward() is meant to be called before the QApplication, and
+ * all it needs is a QCoreApplication.
+ */
+
+class instance : public QObject
+{
+    Q_OBJECT
+public:
+    explicit instance(QObject *parent = 0);
+
+    // Exits on --help, or on anything it doesn't understand.  Launching
+    // with nothing at all asks the running copy to show itself.
+    static QList<QJsonObject> commandsFromArguments(const QStringList &arguments);
+    // The same, for before there is a QApplication to take its options
+    // (-platform, -style and so on) out of the arguments.  False, rather
+    // than exiting, on any option we don't know; those are left for
+    // commandsFromArguments once the QApplication has been at them.
+    static bool commandsBeforeApplication(const QStringList &arguments, QList<QJsonObject> &commands);
+    // True if a running copy took the commands.
+    static bool forward(const QList<QJsonObject> &commands);
+
+    // Start taking commands.  False if another copy got there first.
+    bool listen();
+    // Our own command line, as though it had been forwarded to us.
+    void replay(const QList<QJsonObject> &commands);
+
+signals:
+    void commandReceived(const QString &command, const QString &playlist, const QStringList &files);
+
+private slots:
+    void server_newConnection();
+    void socket_readyRead();
+    void socket_disconnected();
+
+private:
+    QLocalServer *server;
+
+    static QString serverName();
+    static QList<QJsonObject> parseArguments(const QStringList &arguments, bool early, bool &understood);
+    void receive(const QByteArray &line);
+};
+
+#endif // INSTANCE_H
@@ -0,0 +1,38 @@
+#include "latencystats.h"
+#include <algorithm>
+
+latencystats::latencystats(int window) :
+    next(0), window(qMax(1, window))
+{
+}
+
+void latencystats::add(qint64 usecs)
+{
+    if (samples.count() < window) {
+        samples.append(usecs);
+        return;
+    }
+    samples[next] = usecs;
+    next = (next + 1) % window;
+}
+
+void latencystats::clear()
+{
+    samples.clear();
+    next = 0;
+}
+
+int latencystats::count() const
+{
+    return samples.count();
+}
+
+qint64 latencystats::percentile(int percent) const
+{
+    if (samples.isEmpty())
+        return -1;
+    QVector<qint64> sorted = samples;
+    int rank = qBound(1, (percent * sorted.count() + 99) / 100, sorted.count());
+    std::nth_element(sorted.begin(), sorted.begin() + rank - 1, sorted.end());
+    return sorted.at(rank - 1);
+}
@@ -0,0 +1,30 @@
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <QVector>
+
+/* A rolling window of timings, in microseconds, for the player to keep one
+ * of per phase.  Old samples fall out as new ones come in, so percentiles
+ * describe how things are going now rather than since startup.  Sorting a
+ * few hundred numbers when somebody asks is cheap enough that there's no
+ * point keeping a real histogram.
+ */
+
+class latencystats
+{
+public:
+    explicit latencystats(int window = 256);
+
+    void add(qint64 usecs);
+    void clear();
+    int count() const;
+    // Nearest-rank percentile, or -1 if there's nothing to go on.
+    qint64 percentile(int percent) const;
+
+private:
+    QVector<qint64> samples;
+    int next;
+    int window;
+};
+
+#endif // LATENCYSTATS_H
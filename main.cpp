@@ -1,4 +1,6 @@
 #include "window.h"
+#include "instance.h"
+#include "tracer.h"
 #include <QApplication>
 
 int main(int argc, char *argv[])
@@ -6,9 +8,36 @@ int main(int argc, char *argv[])
     QApplication::setOrganizationDomain("github.cmdrkotori.mplaylist");
     QApplication::setOrganizationName("mplaylist");
     QApplication::setApplicationName("mplaylist");
+
+    // If we're already running, hand the command line over and get out of
+    // the way before doing anything expensive, like talking to the display.
+    QList<QJsonObject> commands;
+    bool parsed;
+    {
+        QCoreApplication launcher(argc, argv);
+        parsed = instance::commandsBeforeApplication(launcher.arguments(), commands);
+        if (parsed && instance::forward(commands))
+            return 0;
+    }
+
     QApplication a(argc, argv);
+    if (!parsed) {
+        // There were options for Qt in there, which are gone now.
+        commands = instance::commandsFromArguments(a.arguments());
+        if (instance::forward(commands))
+            return 0;
+    }
+    instance server;
+    if (!server.listen() && instance::forward(commands))
+        return 0;  // somebody started up at the same time, and won
+    // Only now is the trace ours to open.
+    TRACE_INSTANT("main");
     Window w;
+    QObject::connect(&server, SIGNAL(commandReceived(QString,QString,QStringList)),
+                     &w, SLOT(instance_commandReceived(QString,QString,QStringList)));
     w.show();
+    TRACE_INSTANT("Window::show");
+    server.replay(commands);
 
     return a.exec();
 }
@@ -0,0 +1,35 @@
+#-------------------------------------------------
+#
+# The headless half of mplaylist, for scripts and cron jobs.  See cli.h.
+#
+#-------------------------------------------------
+
+QT       += core concurrent
+QT       -= gui
+
+TARGET = mplaylist-cli
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+
+SOURCES += climain.cpp \
+    cli.cpp \
+    storage.cpp \
+    writer.cpp \
+    validator.cpp \
+    probecache.cpp \
+    prober.cpp \
+    sniffer.cpp \
+    dirwalker.cpp \
+    tracer.cpp
+
+HEADERS  += cli.h \
+    storage.h \
+    writer.h \
+    validator.h \
+    probecache.h \
+    prober.h \
+    sniffer.h \
+    dirwalker.h \
+    tracer.h
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -16,12 +16,42 @@ SOURCES += main.cpp\
         widget.cpp \
     window.cpp \
     storage.cpp \
-    player.cpp
+    player.cpp \
+    validator.cpp \
+    writer.cpp \
+    probecache.cpp \
+    prober.cpp \
+    sniffer.cpp \
+    latencystats.cpp \
+    queuemodel.cpp \
+    indexedqueue.cpp \
+    patharena.cpp \
+    dirwalker.cpp \
+    searchindex.cpp \
+    placeholder.cpp \
+    scheduler.cpp \
+    instance.cpp \
+    tracer.cpp
 
 HEADERS  += widget.h \
     window.h \
     storage.h \
-    player.h
+    player.h \
+    validator.h \
+    writer.h \
+    probecache.h \
+    prober.h \
+    sniffer.h \
+    latencystats.h \
+    queuemodel.h \
+    indexedqueue.h \
+    patharena.h \
+    dirwalker.h \
+    searchindex.h \
+    placeholder.h \
+    scheduler.h \
+    instance.h \
+    tracer.h
 
 FORMS    += widget.ui \
     window.ui
@@ -0,0 +1,152 @@
+#include "patharena.h"
+#include <QStringList>
+#include <QHash>
+#include <string.h>
+
+static const quint32 NO_PARENT = 0xffffffffu;
+
+patharena *patharena::instance()
+{
+    static patharena arena;
+    return &arena;
+}
+
+patharena::patharena()
+{
+}
+
+patharena::handle patharena::intern(const QString &path)
+{
+    // Split on the separator and nothing else, so that whatever we were
+    // given comes back exactly the same, doubled slashes and all.
+    QStringList parts = path.split('/');
+    quint32 dir = NO_PARENT;
+    for (int i = 0; i < parts.count() - 1; i++) {
+        QByteArray bytes = parts.at(i).toUtf8();
+        quint32 id;
+        if (!lookup(dirs, dir, bytes, id))
+            id = add(dirs, dir, bytes);
+        dir = id;
+    }
+    QByteArray bytes = parts.last().toUtf8();
+    quint32 id;
+    if (!lookup(files, dir, bytes, id))
+        id = add(files, dir, bytes);
+    return id;
+}
+
+bool patharena::find(const QString &path, handle &result) const
+{
+    QStringList parts = path.split('/');
+    QString leaf = parts.takeLast();
+    quint32 dir;
+    return findDirectory(parts, dir) && lookup(files, dir, leaf.toUtf8(), result);
+}
+
+QString patharena::path(handle file) const
+{
+    const name &n = files.entries.at(file);
+    QString result;
+    if (n.parent != NO_PARENT) {
+        appendDirectory(result, n.parent);
+        result.append('/');
+    }
+    result.append(QString::fromUtf8(names.constData() + n.offset, n.length));
+    return result;
+}
+
+QString patharena::fileName(handle file) const
+{
+    const name &n = files.entries.at(file);
+    return QString::fromUtf8(names.constData() + n.offset, n.length);
+}
+
+qint64 patharena::bytesUsed() const
+{
+    return names.capacity()
+            + (dirs.entries.capacity() + files.entries.capacity()) * sizeof(name)
+            + (dirs.slots.capacity() + files.slots.capacity()) * sizeof(quint32);
+}
+
+QByteArray patharena::nameOf(const name &n) const
+{
+    // No copy; only good for as long as names isn't appended to.
+    return QByteArray::fromRawData(names.constData() + n.offset, n.length);
+}
+
+uint patharena::hashOf(quint32 parent, const QByteArray &bytes)
+{
+    return qHash(bytes) ^ (parent * 2654435761u);
+}
+
+bool patharena::lookup(const table &t, quint32 parent, const QByteArray &bytes, quint32 &result) const
+{
+    if (t.slots.isEmpty())
+        return false;
+    int mask = t.slots.count() - 1;
+    for (int slot = hashOf(parent, bytes) & mask; t.slots.at(slot); slot = (slot + 1) & mask) {
+        const name &n = t.entries.at(t.slots.at(slot) - 1);
+        if (n.parent == parent && n.length == (quint32)bytes.size()
+                && memcmp(names.constData() + n.offset, bytes.constData(), n.length) == 0) {
+            result = t.slots.at(slot) - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+quint32 patharena::add(table &t, quint32 parent, const QByteArray &bytes)
+{
+    name n;
+    n.parent = parent;
+    n.offset = names.size();
+    n.length = bytes.size();
+    names.append(bytes);
+    t.entries.append(n);
+    quint32 id = t.entries.count() - 1;
+
+    // Keep the table at most half full, so probe runs stay short.
+    if (t.entries.count() * 2 > t.slots.count()) {
+        t.slots = QVector<quint32>(qMax(64, t.slots.count() * 2), 0);
+        for (quint32 i = 0; i < id; i++)
+            place(t, i);
+    }
+    place(t, id);
+    return id;
+}
+
+void patharena::place(table &t, quint32 id)
+{
+    const name &n = t.entries.at(id);
+    int mask = t.slots.count() - 1;
+    int slot = hashOf(n.parent, nameOf(n)) & mask;
+    while (t.slots.at(slot))
+        slot = (slot + 1) & mask;
+    t.slots[slot] = id + 1;
+}
+
+bool patharena::findDirectory(const QStringList &parts, quint32 &result) const
+{
+    quint32 dir = NO_PARENT;
+    foreach (const QString &part, parts) {
+        if (!lookup(dirs, dir, part.toUtf8(), dir))
+            return false;
+    }
+    result = dir;
+    return true;
+}
+
+void patharena::appendDirectory(QString &path, quint32 dir) const
+{
+    // Directories are only ever a few deep, so this is walked up into a
+    // small list first rather than prepending to the path over and over.
+    QVector<quint32> chain;
+    for (; dir != NO_PARENT; dir = dirs.entries.at(dir).parent)
+        chain.append(dir);
+    for (int i = chain.count() - 1; i >= 0; i--) {
+        const name &n = dirs.entries.at(chain.at(i));
+        path.append(QString::fromUtf8(names.constData() + n.offset, n.length));
+        if (i > 0)
+            path.append('/');
+    }
+}
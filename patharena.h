@@ -0,0 +1,69 @@
+#ifndef PATHARENA_H
+#define PATHARENA_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+
+/* Big playlists are mostly the same few directories over and over, spelled
+ * out in full, in UTF-16, once per entry.  The arena stores each directory
+ * once, as a name and a link to its parent, and each file as a name and a
+ * link to its directory.  All the names are kept back to back in a single
+ * UTF-8 buffer, and lookups go through open-addressed tables of ids, so the
+ * arena makes no allocation per path.  A queue entry then only needs the
+ * 32-bit handle of its file.  The full path is put back together when
+ * something has to open the file or write the playlist.
+ *
+ * There is one arena for the program, shared by every playlist, and a path
+ * always gets the same handle, so handles can be compared instead of paths.
+ * Nothing is ever taken out of it.  Entries come and go, but the same files
+ * tend to come back, and the arena stays small next to what the queues used
+ * to take.
+ *
+ * Like the widgets that use it, it belongs to the gui thread.
+ */
+
+class patharena
+{
+public:
+    typedef quint32 handle;
+
+    static patharena *instance();
+
+    handle intern(const QString &path);
+    // Like intern, except that paths we haven't seen are not added.
+    bool find(const QString &path, handle &result) const;
+    QString path(handle file) const;
+    QString fileName(handle file) const;
+
+    // For the curious: how much memory the arena is holding on to.
+    qint64 bytesUsed() const;
+
+private:
+    patharena();
+
+    struct name {
+        quint32 parent;     // directory id, or NO_PARENT
+        quint32 offset;     // into names
+        quint32 length;
+    };
+    struct table {
+        QVector<name> entries;
+        QVector<quint32> slots;     // id + 1, or zero for an empty slot
+    };
+
+    QByteArray names;
+    table dirs;
+    table files;
+
+    QByteArray nameOf(const name &n) const;
+    static uint hashOf(quint32 parent, const QByteArray &bytes);
+    bool lookup(const table &t, quint32 parent, const QByteArray &bytes, quint32 &result) const;
+    quint32 add(table &t, quint32 parent, const QByteArray &bytes);
+    void place(table &t, quint32 id);
+    bool findDirectory(const QStringList &parts, quint32 &result) const;
+    void appendDirectory(QString &path, quint32 dir) const;
+};
+
+#endif // PATHARENA_H
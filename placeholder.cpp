@@ -0,0 +1,50 @@
+#include "placeholder.h"
+
+Placeholder::Placeholder(const QString &title, QWidget *parent) :
+    QLabel(parent), title(title), entries(-1), loading(false)
+{
+    setAlignment(Qt::AlignCenter);
+    updateText();
+}
+
+void Placeholder::setTitle(const QString &title)
+{
+    this->title = title;
+}
+
+QString Placeholder::getTitle()
+{
+    return title;
+}
+
+void Placeholder::setCount(int count)
+{
+    entries = count;
+    updateText();
+}
+
+int Placeholder::count()
+{
+    return entries;
+}
+
+void Placeholder::setLoading(bool loading)
+{
+    this->loading = loading;
+    updateText();
+}
+
+bool Placeholder::isLoading()
+{
+    return loading;
+}
+
+void Placeholder::updateText()
+{
+    if (entries < 0)
+        setText(tr("Reading playlist..."));
+    else if (loading)
+        setText(tr("Loading %n entries...", "", entries));
+    else
+        setText(tr("%n entries", "", entries));
+}
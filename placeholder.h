@@ -0,0 +1,37 @@
+#ifndef PLACEHOLDER_H
+#define PLACEHOLDER_H
+
+#include <QLabel>
+
+/* What sits in a tab whose playlist isn't loaded.  A Widget, with its form,
+ * player and model, costs far more than most tabs are worth if nobody looks
+ * at them, so the window only builds one when a tab is first shown, and puts
+ * it back to one of these once it has sat idle for long enough.
+ *
+ * All a placeholder knows is the title and how many entries there were.  It
+ * is disabled while the playlist is still being enumerated, and says so
+ * while its entries are being fetched again.
+ */
+
+class Placeholder : public QLabel
+{
+    Q_OBJECT
+public:
+    explicit Placeholder(const QString &title, QWidget *parent = 0);
+
+    void setTitle(const QString &title);
+    QString getTitle();
+    void setCount(int count);
+    int count();
+    void setLoading(bool loading);
+    bool isLoading();
+
+private:
+    QString title;
+    int entries;
+    bool loading;
+
+    void updateText();
+};
+
+#endif // PLACEHOLDER_H
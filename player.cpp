@@ -1,5 +1,17 @@
 #include "player.h"
-#include <QDebug>
+#include "tracer.h"
+#include <QLoggingCategory>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
+#include <QTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QCoreApplication>
+#include <QtConcurrent>
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
 
 const int QP_EXIT_NONSTARTER = 4;
 const int QP_EXIT_BADFILE = 3;
@@ -7,43 +19,121 @@ const int QP_EXIT_END = 2;
 const int QP_EXIT_QUIT = 1;
 const int QP_EXIT_NONE = 0;
 
-player::player(QObject *parent) :
-    QObject(parent), qp(NULL)
-{
-}
+// How often and how many times to knock on mpv's socket while it starts up.
+const int IPC_RETRY_INTERVAL = 50;
+const int IPC_RETRY_LIMIT = 100;
 
-player::~player()
+// How long mpv gets to quit on its own before it is killed.
+const int MPV_QUIT_TIMEOUT = 1000;
+
+Q_LOGGING_CATEGORY(latencyLog, "mplaylist.latency", QtWarningMsg)
+
+// How much of the next file to read ahead, unless configured otherwise.  One
+// part in TAIL_SHARE of it goes to the end of the file, which is where the
+// index of many containers (mp4 moov, matroska cues) lives.
+const qint64 READAHEAD_DEFAULT = 8 * 1024 * 1024;
+const qint64 TAIL_SHARE = 8;
+
+static void readahead(const QString &fileName, qint64 budget)
 {
-    if (qp) {
-        delete qp;
+    // Opening a file on a sleepy share can take a while, which is why this
+    // runs on the thread pool.
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    qint64 size = file.size();
+    qint64 head = qMin(size, budget - budget / TAIL_SHARE);
+    qint64 tail = qMin(size - head, budget / TAIL_SHARE);
+#ifdef Q_OS_LINUX
+    // Let the kernel do the reading, without dragging the data through us.
+    posix_fadvise(file.handle(), 0, head, POSIX_FADV_WILLNEED);
+    if (tail > 0)
+        posix_fadvise(file.handle(), size - tail, tail, POSIX_FADV_WILLNEED);
+#else
+    QByteArray buffer;
+    for (qint64 done = 0; done < head; done += buffer.size()) {
+        buffer = file.read(qMin(head - done, qint64(1024 * 1024)));
+        if (buffer.isEmpty())
+            return;
     }
+    if (tail > 0 && file.seek(size - tail))
+        while (!file.read(1024 * 1024).isEmpty()) {}
+#endif
 }
 
-void player::checkFiles(QStringList &list)
+player::player(QObject *parent) :
+    QObject(parent), qp(NULL), persistent(false), mpv(NULL), ipc(NULL),
+    ipcAttempts(0), currentEntry(-1), lastRequest(0), loadRequest(-1), appendRequest(-1),
+    expectedEntry(-1), nextEntry(-1), awaitingStart(false), rolledOver(false),
+    readAhead(false), requestedAt(-1), startedAt(-1), endedAt(-1), seenFrame(true)
 {
-    // instead of a simple foreach loop and maintaining a seperate list for
-    // returning, we shall use slightly different and more simple iterator
-    // that allows us to modify the list in-place.
-    QMutableStringListIterator i(list);
-    while (i.hasNext())
-        if (!checkFile(i.next()))
-            i.remove();
+    QSettings settings;
+    persistent = settings.value("player/persistent", false).toBool();
+    readaheadBytes = settings.value("player/readaheadBytes", READAHEAD_DEFAULT).toLongLong();
+    clock.start();
 }
 
-bool player::checkFile(QString fileName)
+player::~player()
 {
-    // we're using our own private process this time, because we don't want
-    // to muck up the main process in case something is playing.
-    QProcess check;
-    check.start("mpv", QStringList() << "--no-config" << "--no-video" << "--no-audio" << fileName);
-    return check.waitForFinished() && !check.readAll().contains("Failed to recognize file format.");
+    if (latencyLog().isDebugEnabled()) {
+        for (int phase = 0; phase < lpPhaseCount; phase++) {
+            if (!latencySamples(phase))
+                continue;
+            qCDebug(latencyLog) << phaseName(phase)
+                                << "p50" << latencyPercentile(phase, 50) / 1000.0
+                                << "p95" << latencyPercentile(phase, 95) / 1000.0
+                                << "p99" << latencyPercentile(phase, 99) / 1000.0
+                                << "ms over" << latencySamples(phase) << "samples";
+        }
+    }
+    if (qp) {
+        delete qp;
+    }
+    if (mpv) {
+        // Asked nicely, mpv tidies up after itself, socket and all.  Killed,
+        // it leaves the socket behind in the temp directory.
+        mpv->disconnect(this);
+        if (ipc && ipc->state() == QLocalSocket::ConnectedState) {
+            sendCommand(QStringList() << "quit");
+            ipc->flush();
+        }
+        if (!mpv->waitForFinished(MPV_QUIT_TIMEOUT)) {
+            mpv->kill();
+            mpv->waitForFinished();
+        }
+        delete mpv;
+        removeSocket();
+    }
 }
 
 void player::playFile(QString fileName)
 {
+    TRACE_SCOPE("player::playFile", fileName);
+    requestOfTrack();
+    readAhead = !prefetchedFile.isEmpty() && fileName == prefetchedFile;
+    if (persistent) {
+        // mpv has already moved on to this file by itself.
+        if (rolledOver && fileName == playingFile) {
+            rolledOver = false;
+            return;
+        }
+        startPersistent();
+        rolledOver = false;
+        currentEntry = -1;
+        awaitingStart = true;
+        playingFile = fileName;
+        nextFile.clear();
+        loadRequest = ++lastRequest;
+        expectedEntry = -1;
+        appendRequest = -1;
+        nextEntry = -1;
+        sendCommand(QStringList() << "loadfile" << fileName << "replace", loadRequest);
+        return;
+    }
     stopFile();
     qp = new QProcess(this);
     exitState = QP_EXIT_NONE;
+    connect(qp, SIGNAL(started()), this, SLOT(process_started()));
     connect(qp, SIGNAL(readyReadStandardOutput()), this, SLOT(process_read_output()));
     connect(qp, SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(process_finished(int,QProcess::ExitStatus)));
     qp->start("mpv", QStringList() << fileName);
@@ -52,27 +142,83 @@ void player::playFile(QString fileName)
 
 void player::stopFile()
 {
+    if (persistent) {
+        if (!playingFile.isEmpty()) {
+            currentEntry = -1;
+            awaitingStart = false;
+            rolledOver = false;
+            loadRequest = appendRequest = -1;
+            playingFile.clear();
+            nextFile.clear();
+            sendCommand(QStringList() << "stop");
+        }
+        return;
+    }
     if (qp) {
+        qint64 since = now();
         qp->kill();
         qp->waitForFinished();
         delete qp;
         qp = NULL;
         playingFile.clear();
+        measure(lpStop, since);
+    }
+}
+
+void player::setNextFile(const QString &fileName)
+{
+    if (readaheadBytes > 0 && !fileName.isEmpty() && fileName != prefetchedFile) {
+        prefetchedFile = fileName;
+        QtConcurrent::run(readahead, fileName, readaheadBytes);
     }
+    if (!persistent || !mpv || fileName == nextFile)
+        return;
+    nextFile = fileName;
+    nextEntry = -1;
+    appendRequest = fileName.isEmpty() ? -1 : ++lastRequest;
+    sendCommand(QStringList() << "playlist-clear");
+    if (!fileName.isEmpty())
+        sendCommand(QStringList() << "loadfile" << fileName << "append", appendRequest);
 }
 
 void player::kill()
 {
+    if (persistent) {
+        // Unlike stopFile, this one is reported, as playbackHalted.
+        if (!playingFile.isEmpty())
+            sendCommand(QStringList() << "stop");
+        return;
+    }
     if (qp) {
         qp->kill();
         playingFile.clear();
     }
 }
 
+bool player::isPlaying() const
+{
+    if (persistent)
+        return !playingFile.isEmpty();
+    return qp && qp->state() != QProcess::NotRunning;
+}
+
+void player::process_started()
+{
+    beginningOfTrack();
+}
+
 void player::process_read_output()
 {
+    // mpv's "Playing:" line comes before it has even opened the file.  The
+    // AO and VO lines only come once the first decoded frame has reached
+    // the outputs, which is as close to the first frame as the console lets
+    // us get.
     QString out(qp->readAllStandardOutput());
+    if (out.contains("AO: [") || out.contains("VO: ["))
+        startOfTrack();
     if (out.contains("Exiting... (End of file)")) {
+        // This is as soon as we can know; the process still has to exit.
+        endOfTrack();
         exitState = QP_EXIT_END;
     }
     if (out.contains("Exiting... (Quit)")) {
@@ -96,6 +242,7 @@ void player::process_finished(int exitCode, QProcess::ExitStatus exitStatus)
         break;
     case QP_EXIT_END:
         emit playbackFinished(playingFile);
+        abandonTrack();
         break;
     case QP_EXIT_QUIT:
         emit playbackQuit(playingFile);
@@ -109,3 +256,267 @@ void player::process_finished(int exitCode, QProcess::ExitStatus exitStatus)
     }
 }
 
+
+QString player::phaseName(int phase)
+{
+    switch (phase) {
+    case lpStop:
+        return "stop";
+    case lpStart:
+        return "start";
+    case lpFirstFrame:
+        return "first frame";
+    case lpHandoff:
+        return "handoff";
+    case lpGap:
+        return "gap";
+    case lpGapReadAhead:
+        return "gap, read ahead";
+    }
+    return QString();
+}
+
+qint64 player::latencyPercentile(int phase, int percent) const
+{
+    if (phase < 0 || phase >= lpPhaseCount)
+        return -1;
+    return latencies[phase].percentile(percent);
+}
+
+int player::latencySamples(int phase) const
+{
+    if (phase < 0 || phase >= lpPhaseCount)
+        return 0;
+    return latencies[phase].count();
+}
+
+qint64 player::now() const
+{
+    return clock.nsecsElapsed() / 1000;
+}
+
+void player::measure(int phase, qint64 since)
+{
+    if (since < 0)
+        return;
+    qint64 usecs = now() - since;
+    latencies[phase].add(usecs);
+    qCDebug(latencyLog) << phaseName(phase) << usecs / 1000.0 << "ms";
+    emit latencyMeasured(phase, usecs);
+}
+
+void player::requestOfTrack()
+{
+    measure(lpHandoff, endedAt);
+    requestedAt = now();
+    startedAt = -1;
+    seenFrame = false;
+}
+
+void player::beginningOfTrack()
+{
+    startedAt = now();
+    measure(lpStart, requestedAt);
+    requestedAt = -1;
+}
+
+void player::endOfTrack()
+{
+    endedAt = now();
+}
+
+void player::abandonTrack()
+{
+    // The next file is always asked for while playbackFinished is being
+    // handled.  If it wasn't, there's no gap to measure, just a stop.
+    if (requestedAt < endedAt)
+        endedAt = -1;
+}
+
+void player::startOfTrack()
+{
+    if (seenFrame)
+        return;
+    seenFrame = true;
+    measure(lpFirstFrame, startedAt);
+    if (endedAt < 0)
+        return;
+    measure(readAhead ? lpGapReadAhead : lpGap, endedAt);
+    endedAt = -1;
+}
+
+void player::startPersistent()
+{
+    if (mpv)
+        return;
+#ifdef Q_OS_WIN
+    ipcName = QString("mplaylist-%1-%2").arg(QCoreApplication::applicationPid()).arg(quintptr(this));
+    QString serverName = "\\\\.\\pipe\\" + ipcName;
+#else
+    ipcName = QDir::temp().filePath(QString("mplaylist-%1-%2.sock")
+                                    .arg(QCoreApplication::applicationPid()).arg(quintptr(this)));
+    QString serverName = ipcName;
+#endif
+    mpv = new QProcess(this);
+    connect(mpv, SIGNAL(finished(int,QProcess::ExitStatus)), SLOT(mpv_finished()));
+    mpv->start("mpv", QStringList() << "--idle=yes" << "--input-ipc-server=" + serverName);
+
+    ipc = new QLocalSocket(this);
+    connect(ipc, SIGNAL(connected()), SLOT(ipc_connected()));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    connect(ipc, SIGNAL(errorOccurred(QLocalSocket::LocalSocketError)), SLOT(ipc_error()));
+#else
+    connect(ipc, SIGNAL(error(QLocalSocket::LocalSocketError)), SLOT(ipc_error()));
+#endif
+    connect(ipc, SIGNAL(readyRead()), SLOT(ipc_readyRead()));
+    ipcAttempts = 0;
+    ipc_connect();
+}
+
+void player::sendCommand(const QStringList &command, qint64 requestId)
+{
+    QJsonObject object;
+    object.insert("command", QJsonArray::fromStringList(command));
+    if (requestId >= 0)
+        object.insert("request_id", requestId);
+    QByteArray line = QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n';
+    if (ipc && ipc->state() == QLocalSocket::ConnectedState)
+        ipc->write(line);
+    else
+        ipcPending.append(line);
+}
+
+void player::handleEvent(const QJsonObject &event)
+{
+    QString name = event.value("event").toString();
+    qint64 entry = (qint64)event.value("playlist_entry_id").toDouble(-1);
+
+    if (name == "playback-restart") {
+        startOfTrack();
+        return;
+    }
+    if (name == "start-file") {
+        // Without an entry id in the reply (mpv 0.33), the first start-file
+        // after it has to do.
+        if (awaitingStart && loadRequest < 0 && (expectedEntry < 0 || entry == expectedEntry)) {
+            currentEntry = entry;
+            awaitingStart = false;
+            beginningOfTrack();
+        }
+        return;
+    }
+    if (name != "end-file" || currentEntry < 0 || entry != currentEntry)
+        return;
+
+    QString reason = event.value("reason").toString();
+    QString file = playingFile;
+    currentEntry = -1;
+    if (reason == "eof") {
+        endOfTrack();
+        // If the next file was queued, mpv is already on its way to it.
+        playingFile = nextFile;
+        rolledOver = awaitingStart = !nextFile.isEmpty();
+        expectedEntry = nextEntry;
+        nextFile.clear();
+        nextEntry = -1;
+        emit playbackFinished(file);
+        abandonTrack();
+        return;
+    }
+
+    playingFile.clear();
+    if (!nextFile.isEmpty()) {
+        // mpv would carry on to the queued file, which the process player
+        // never did after a failure.
+        nextFile.clear();
+        sendCommand(QStringList() << "stop");
+    }
+    if (reason == "quit")
+        emit playbackQuit(file);
+    else if (reason == "error" && event.value("file_error").toString() == "unrecognized file format")
+        emit playbackBadFile(file);
+    else if (reason == "error")  // e.g. from an unavailable video output
+        emit playbackNonstart(file);
+    else
+        emit playbackHalted(file);
+}
+
+void player::mpv_finished()
+{
+    // Somebody closed mpv.  A new one is started with the next file.
+    QString file = playingFile;
+    bool wasPlaying = currentEntry >= 0 || awaitingStart;
+    mpv->deleteLater();
+    mpv = NULL;
+    removeSocket();
+    ipc->disconnect(this);
+    ipc->deleteLater();
+    ipc = NULL;
+    ipcPending.clear();
+    ipcBuffer.clear();
+    playingFile.clear();
+    nextFile.clear();
+    currentEntry = -1;
+    loadRequest = appendRequest = -1;
+    awaitingStart = false;
+    rolledOver = false;
+    if (wasPlaying)
+        emit playbackQuit(file);
+}
+
+void player::removeSocket()
+{
+    // A pipe goes away with the last handle to it; a unix socket doesn't.
+#ifndef Q_OS_WIN
+    if (!ipcName.isEmpty())
+        QFile::remove(ipcName);
+#endif
+}
+
+void player::ipc_connect()
+{
+    if (ipc)
+        ipc->connectToServer(ipcName);
+}
+
+void player::ipc_connected()
+{
+    foreach (const QByteArray &line, ipcPending)
+        ipc->write(line);
+    ipcPending.clear();
+}
+
+void player::ipc_error()
+{
+    // mpv takes a moment to create its socket, so keep trying for a while.
+    if (ipc && ipc->state() == QLocalSocket::UnconnectedState
+            && ++ipcAttempts < IPC_RETRY_LIMIT)
+        QTimer::singleShot(IPC_RETRY_INTERVAL, this, SLOT(ipc_connect()));
+}
+
+void player::ipc_readyRead()
+{
+    ipcBuffer.append(ipc->readAll());
+    int eol;
+    while ((eol = ipcBuffer.indexOf('\n')) >= 0) {
+        QJsonObject message = QJsonDocument::fromJson(ipcBuffer.left(eol)).object();
+        ipcBuffer.remove(0, eol + 1);
+        if (message.contains("event"))
+            handleEvent(message);
+        else if (message.contains("request_id"))
+            handleReply(message);
+    }
+}
+
+void player::handleReply(const QJsonObject &reply)
+{
+    qint64 id = (qint64)reply.value("request_id").toDouble(-1);
+    qint64 entry = (qint64)reply.value("data").toObject().value("playlist_entry_id").toDouble(-1);
+    if (id == loadRequest) {
+        loadRequest = -1;
+        expectedEntry = entry;
+    } else if (id == appendRequest) {
+        appendRequest = -1;
+        nextEntry = entry;
+    }
+}
@@ -3,6 +3,10 @@
 
 #include <QObject>
 #include <QProcess>
+#include <QLocalSocket>
+#include <QJsonObject>
+#include <QElapsedTimer>
+#include "latencystats.h"
 
 /* The advantage of spinning off mpv-specific functions to a seperate module
  * is that you can use different players so long as they support the same
@@ -20,6 +24,21 @@
  *
  * WHY: Currently we use an state-based approach to program exit; it's messy
  * and depends upon arbitrary console output much the same way slave mode did.
+ *
+ * Setting player/persistent in the config gets you the halfway house: one mpv
+ * is kept idling for the life of the player and fed files over its JSON IPC
+ * socket.  The outcome of each file comes from mpv's end-file events instead
+ * of its console, and the next file is queued up ahead of time so mpv can
+ * move on to it without a gap.  This needs mpv 0.33 or newer.
+ *
+ * Either way, the start of the next file is read ahead into the page cache
+ * while the current one plays (player/readaheadBytes, zero to turn it off),
+ * so that spinning disks and network shares don't make us wait for it.
+ *
+ * Each step of getting a file going is timed, and the last few hundred of
+ * each are kept for latencyPercentile().  Every measurement, and a summary
+ * at exit, is logged under the mplaylist.latency category, which is off
+ * unless turned on with QT_LOGGING_RULES="mplaylist.latency.debug=true".
  */
 
 class player : public QObject
@@ -29,31 +48,110 @@ public:
     explicit player(QObject *parent = 0);
     ~player();
 
-    void checkFiles(QStringList &list);
-    bool checkFile(QString fileName);
-
     void playFile(QString fileName);
     void stopFile();
+    // What to play after the current file, if nothing changes in between.
+    // It gets read ahead, and the persistent player queues it up as well.
+    void setNextFile(const QString &fileName);
 
     void kill();
+    // Whether a file is under way, or about to be.
+    bool isPlaying() const;
+
+    // The steps that make up the wait between one file and the next.  Start
+    // and first frame are measured in both modes; stop only applies to the
+    // process player, where it is a kill and a blocking wait.  The gap is
+    // kept apart for files that were and weren't read ahead when they were
+    // asked for, so the two can be compared.
+    enum lifecyclePhase {
+        lpStop,         // killing the previous mpv, in stopFile
+        lpStart,        // playFile until mpv has started (or begun the file)
+        lpFirstFrame,   // from there until the first frame is out
+        lpHandoff,      // end of file detected until the next playFile
+        lpGap,          // end of file detected until the next one's first
+        lpGapReadAhead, // frame, without and with the next one read ahead
+        lpPhaseCount
+    };
+    static QString phaseName(int phase);
+    qint64 latencyPercentile(int phase, int percent) const;
+    int latencySamples(int phase) const;
 
 private:
     QProcess *qp;
     int exitState;
     QString playingFile;
 
+    // The persistent player.  We only trust end-file events for the entry we
+    // know to be playing; everything else belongs to files we replaced.
+    // mpv answers our loadfile before it starts the file, and from 0.34 on
+    // says which entry it made.  So a start-file before the answer, or for
+    // another entry, is not ours; it may be the queued file, which mpv
+    // rolled over to while the loadfile was on its way.
+    bool persistent;
+    QProcess *mpv;
+    QLocalSocket *ipc;
+    QString ipcName;
+    QByteArray ipcBuffer;
+    QList<QByteArray> ipcPending;
+    int ipcAttempts;
+    QString nextFile;
+    qint64 currentEntry;
+    qint64 lastRequest;
+    qint64 loadRequest;     // the loadfile replace not yet answered, or -1
+    qint64 appendRequest;   // likewise for the next file
+    qint64 expectedEntry;   // what the loadfile said it added, or -1
+    qint64 nextEntry;
+    bool awaitingStart;
+    bool rolledOver;
+
+    // Read ahead, and the measurement of whether it helps.  Whether the file
+    // was read ahead has to be noted when it is asked for; by the time it
+    // plays, the next one along is being read ahead instead.
+    qint64 readaheadBytes;
+    QString prefetchedFile;
+    bool readAhead;
+
+    // Lifecycle timestamps, in microseconds on the clock, or -1 when the
+    // step hasn't happened yet for the current file.
+    QElapsedTimer clock;
+    qint64 requestedAt;
+    qint64 startedAt;
+    qint64 endedAt;
+    bool seenFrame;
+    latencystats latencies[lpPhaseCount];
+    qint64 now() const;
+    void measure(int phase, qint64 since);
+    void requestOfTrack();
+    void beginningOfTrack();
+    void endOfTrack();
+    void abandonTrack();
+    void startOfTrack();
+
+    void startPersistent();
+    void removeSocket();
+    void sendCommand(const QStringList &command, qint64 requestId = -1);
+    void handleEvent(const QJsonObject &event);
+    void handleReply(const QJsonObject &reply);
+
 signals:
     void playbackFinished(const QString &fileJustPlayed);
     void playbackHalted(const QString &fileJustPlayed);
     void playbackQuit(const QString &fileJustPlayed);
     void playbackBadFile(const QString &fileNotPlayed);
     void playbackNonstart(const QString &fileNotPlayed);
+    void latencyMeasured(int phase, qint64 usecs);
 
 public slots:
 
 private slots:
+    void process_started();
     void process_read_output();
     void process_finished(int exitCode, QProcess::ExitStatus exitStatus);
+    void mpv_finished();
+    void ipc_connect();
+    void ipc_connected();
+    void ipc_error();
+    void ipc_readyRead();
 
 };
 
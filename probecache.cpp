@@ -0,0 +1,159 @@
+#include "probecache.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+static const QString CACHE_FILE("probes.bin");
+static const quint32 CACHE_MAGIC = 0x4d505043;  // "MPPC"
+static const quint32 CACHE_VERSION = 1;
+// Save every so often, so that a crash doesn't cost us every probe since
+// the program started.
+static const int SAVE_INTERVAL = 256;
+// Entries for files we haven't seen in this long are dropped, in seconds.
+static const qint64 ENTRY_LIFETIME = 90 * 24 * 60 * 60;
+
+probecache *probecache::instance()
+{
+    static probecache cache;
+    return &cache;
+}
+
+probecache::probecache() :
+    hitCount(0), missCount(0), unsaved(0)
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    QDir().mkpath(dir);
+    cachePath = QDir(dir).filePath(CACHE_FILE);
+    load();
+}
+
+probecache::~probecache()
+{
+    if (unsaved)
+        save();
+}
+
+bool probecache::stamp::operator==(const stamp &other) const
+{
+    return size == other.size && modified == other.modified && inode == other.inode;
+}
+
+bool probecache::lookup(const QString &fileName, probe &result)
+{
+    stamp fileStamp;
+    bool exists = stampFile(fileName, fileStamp);
+    QMutexLocker lock(&mutex);
+    QHash<QString, entry>::iterator i = entries.find(fileName);
+    if (!exists || i == entries.end() || !(i->fileStamp == fileStamp)) {
+        missCount++;
+        return false;
+    }
+    hitCount++;
+    i->lastUsed = QDateTime::currentMSecsSinceEpoch() / 1000;
+    result = i->result;
+    return true;
+}
+
+void probecache::insert(const QString &fileName, const probe &result)
+{
+    entry e;
+    if (!stampFile(fileName, e.fileStamp))
+        return;
+    e.lastUsed = QDateTime::currentMSecsSinceEpoch() / 1000;
+    e.result = result;
+    QMutexLocker lock(&mutex);
+    entries.insert(fileName, e);
+    if (++unsaved >= SAVE_INTERVAL)
+        save();
+}
+
+int probecache::hits()
+{
+    QMutexLocker lock(&mutex);
+    return hitCount;
+}
+
+int probecache::misses()
+{
+    QMutexLocker lock(&mutex);
+    return missCount;
+}
+
+bool probecache::stampFile(const QString &fileName, stamp &result)
+{
+#ifdef Q_OS_UNIX
+    // One stat() gets us everything, inode included.
+    struct stat st;
+    if (::stat(QFile::encodeName(fileName).constData(), &st) != 0)
+        return false;
+    result.size = st.st_size;
+    result.modified = st.st_mtime;
+    result.inode = st.st_ino;
+#else
+    QFileInfo info(fileName);
+    if (!info.exists())
+        return false;
+    result.size = info.size();
+    result.modified = info.lastModified().toMSecsSinceEpoch() / 1000;
+    result.inode = 0;
+#endif
+    return true;
+}
+
+void probecache::load()
+{
+    // A missing or mangled cache is just an empty one.
+    QFile file(cachePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    QDataStream ds(&file);
+    ds.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version, count;
+    ds >> magic >> version >> count;
+    if (magic != CACHE_MAGIC || version != CACHE_VERSION)
+        return;
+    QHash<QString, entry> loaded;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; i++) {
+        QString fileName;
+        entry e;
+        ds >> fileName >> e.fileStamp.size >> e.fileStamp.modified >> e.fileStamp.inode
+           >> e.lastUsed >> e.result.playable >> e.result.streams;
+        loaded.insert(fileName, e);
+    }
+    if (ds.status() == QDataStream::Ok)
+        entries = loaded;
+}
+
+void probecache::save()
+{
+    // Called with the mutex held, or from the destructor.
+    qint64 now = QDateTime::currentMSecsSinceEpoch() / 1000;
+    QHash<QString, entry>::iterator i = entries.begin();
+    while (i != entries.end()) {
+        if (now - i->lastUsed > ENTRY_LIFETIME)
+            i = entries.erase(i);
+        else
+            ++i;
+    }
+
+    QSaveFile file(cachePath);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    QDataStream ds(&file);
+    ds.setVersion(QDataStream::Qt_5_0);
+    ds << CACHE_MAGIC << CACHE_VERSION << quint32(entries.count());
+    QHash<QString, entry>::const_iterator j;
+    for (j = entries.constBegin(); j != entries.constEnd(); ++j) {
+        ds << j.key() << j->fileStamp.size << j->fileStamp.modified << j->fileStamp.inode
+           << j->lastUsed << j->result.playable << j->result.streams;
+    }
+    if (ds.status() == QDataStream::Ok && file.commit())
+        unsaved = 0;
+}
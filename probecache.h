@@ -0,0 +1,61 @@
+#ifndef PROBECACHE_H
+#define PROBECACHE_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+
+/* Asking mpv whether it can play a file means starting a whole mpv, which is
+ * fine for one file and painful for a folder of two thousand.  So we remember
+ * what mpv said about each file, keyed on its path, size, modification time
+ * and (where there is such a thing) inode.  If any of those change, the file
+ * is probed again.  A repeat check then costs a single stat().
+ *
+ * The cache is kept in the user's cache directory and shared by every player
+ * in the program, and is safe to use from any thread.
+ */
+
+class probecache
+{
+public:
+    struct probe {
+        bool playable;
+        QString streams;    // the stream lines mpv printed, for the curious
+    };
+
+    static probecache *instance();
+    ~probecache();
+
+    bool lookup(const QString &fileName, probe &result);
+    void insert(const QString &fileName, const probe &result);
+
+    // For checking that the cache is earning its keep.
+    int hits();
+    int misses();
+
+private:
+    probecache();
+
+    struct stamp {
+        qint64 size, modified, inode;
+        bool operator==(const stamp &other) const;
+    };
+    struct entry {
+        stamp fileStamp;
+        qint64 lastUsed;
+        probe result;
+    };
+
+    QMutex mutex;
+    QString cachePath;
+    QHash<QString, entry> entries;
+    int hitCount;
+    int missCount;
+    int unsaved;
+
+    static bool stampFile(const QString &fileName, stamp &result);
+    void load();
+    void save();
+};
+
+#endif // PROBECACHE_H
@@ -0,0 +1,310 @@
+#include "prober.h"
+#include "sniffer.h"
+#include "tracer.h"
+#include <QThread>
+#include <QTimer>
+#include <QtConcurrent>
+
+// Same as the default for QProcess::waitForFinished, which is what we had
+// before, in milliseconds.  For a batch, it's how long mpv may go without
+// saying anything.
+static const int PROBE_TIMEOUT = 30000;
+// Big enough to make starting mpv cheap, small enough that the progress bar
+// still moves and a crash doesn't throw away too much work.
+static const int MAX_BATCH = 32;
+// Files looked up in the cache and sniffed per trip to the thread pool, and
+// how many of those trips may be out at once.
+static const int PRECHECK_BATCH = 64;
+static const int MAX_PRECHECKS = 2;
+static const char PLAYING_PREFIX[] = "Playing: ";
+
+prober::prober(QObject *parent) :
+    QObject(parent), nextToCheck(0), nextToDeliver(0), done(0),
+    maxProcesses(qMax(1, QThread::idealThreadCount()))
+{
+}
+
+prober::~prober()
+{
+    // Our owner is on its way out too, so don't tell it anything.
+    blockSignals(true);
+    cancel();
+}
+
+void prober::probe(const QStringList &files)
+{
+    if (files.isEmpty())
+        return;
+    this->files.append(files);
+    states.resize(this->files.count());
+    startMore();
+    deliver();
+}
+
+void prober::cancel()
+{
+    // Whatever was accepted so far has already been handed out, so we only
+    // need to stop the rest.
+    bool busy = isBusy();
+    foreach (QProcess *process, processes.keys()) {
+        process->disconnect(this);
+        process->kill();
+        process->waitForFinished();
+        delete process;
+    }
+    processes.clear();
+    // Whatever they find out is of no interest now.
+    foreach (QFutureWatcher<precheck> *watcher, prechecks) {
+        watcher->disconnect(this);
+        watcher->deleteLater();
+    }
+    prechecks.clear();
+    reset();
+    if (busy)
+        emit finished();
+}
+
+bool prober::isBusy()
+{
+    return !files.isEmpty();
+}
+
+int prober::pending()
+{
+    return files.count() - done;
+}
+
+void prober::setMaxProcesses(int count)
+{
+    maxProcesses = qMax(1, count);
+    startMore();
+}
+
+QStringList prober::probeArguments(const QString &fileName)
+{
+    return QStringList() << "--no-config" << "--no-video" << "--no-audio" << fileName;
+}
+
+probecache::probe prober::readProbe(bool finished, const QString &output)
+{
+    probecache::probe result;
+    result.playable = finished && !output.contains("Failed to recognize file format.");
+    foreach (const QString &line, output.split('\n')) {
+        if (line.contains("--vid=") || line.contains("--aid=") || line.contains("--sid="))
+            result.streams.append(line.trimmed() + '\n');
+    }
+    return result;
+}
+
+QStringList prober::batchArguments(const QStringList &files)
+{
+    // The same options as a single probe, so mpv behaves the same for each
+    // file; it just moves on to the next one instead of exiting.
+    QStringList arguments = probeArguments(QString());
+    arguments.removeLast();
+    return arguments + files;
+}
+
+QList<probecache::probe> prober::readBatch(const QStringList &files, bool finished, const QString &output)
+{
+    QList<probecache::probe> results;
+    if (files.isEmpty())
+        return results;
+    if (files.count() == 1) {
+        // Nothing to split, and an unfinished probe is a rejection, as ever.
+        results.append(readProbe(finished, output));
+        return results;
+    }
+
+    // A file's output runs until mpv announces the next one.  Playlists get
+    // expanded in place by mpv, so their entries' announcements are just
+    // part of the playlist's output, as they would be when probed alone.
+    QString segment;
+    bool started = false;
+    foreach (const QString &line, output.split('\n')) {
+        int next = started ? results.count() + 1 : 0;
+        if (next < files.count() && line == PLAYING_PREFIX + files.at(next)) {
+            if (started)
+                results.append(readProbe(true, segment));
+            started = true;
+            segment.clear();
+            continue;
+        }
+        if (started)
+            segment.append(line).append('\n');
+    }
+    // The last file we saw is only known to be done if mpv finished cleanly
+    // and there's nothing after it that it never got to.
+    if (started && finished && results.count() == files.count() - 1)
+        results.append(readProbe(true, segment));
+    return results;
+}
+
+void prober::process_finished()
+{
+    QProcess *process = static_cast<QProcess*>(sender());
+    complete(process, process->exitStatus() == QProcess::NormalExit);
+}
+
+void prober::process_error(QProcess::ProcessError error)
+{
+    // Crashes and timeouts are followed by finished(), a failure to start
+    // (no mpv, for one) is not.
+    if (error == QProcess::FailedToStart)
+        complete(static_cast<QProcess*>(sender()), false);
+}
+
+void prober::process_readyRead()
+{
+    // Still alive, so give it more time.  The output is left for complete()
+    // to read in one go.
+    QTimer *timeout = sender()->findChild<QTimer*>();
+    if (timeout)
+        timeout->start();
+}
+
+void prober::precheck_finished()
+{
+    QFutureWatcher<precheck> *watcher = static_cast<QFutureWatcher<precheck>*>(sender());
+    prechecks.removeOne(watcher);
+    precheck checked = watcher->result();
+    watcher->deleteLater();
+    for (int i = 0; i < checked.states.count(); i++) {
+        int index = checked.first + i;
+        if (checked.states.at(i) == psWaiting) {
+            unsure.append(index);
+        } else {
+            states[index] = checked.states.at(i);
+            done++;
+        }
+    }
+    startMore();
+    deliver();
+}
+
+prober::precheck prober::runPrecheck(int first, const QStringList &files)
+{
+    // This runs on the thread pool.  The cache looks after its own locking,
+    // and the sniffer has nothing to lock.
+    TRACE_SCOPE("prober::runPrecheck");
+    precheck checked;
+    checked.first = first;
+    checked.states.fill(psWaiting, files.count());
+    for (int i = 0; i < files.count(); i++) {
+        probecache::probe result;
+        if (probecache::instance()->lookup(files.at(i), result)) {
+            checked.states[i] = result.playable ? psAccepted : psRejected;
+            continue;
+        }
+        sniffer::verdict verdict = sniffer::sniff(files.at(i));
+        if (verdict != sniffer::svUnknown)
+            checked.states[i] = verdict == sniffer::svPlayable ? psAccepted : psRejected;
+    }
+    return checked;
+}
+
+void prober::startMore()
+{
+    while (prechecks.count() < MAX_PRECHECKS && nextToCheck < files.count()) {
+        int count = qMin(PRECHECK_BATCH, files.count() - nextToCheck);
+        QFutureWatcher<precheck> *watcher = new QFutureWatcher<precheck>(this);
+        connect(watcher, SIGNAL(finished()), SLOT(precheck_finished()));
+        prechecks.append(watcher);
+        watcher->setFuture(QtConcurrent::run(&prober::runPrecheck, nextToCheck,
+                                             files.mid(nextToCheck, count)));
+        nextToCheck += count;
+    }
+
+    while (processes.count() < maxProcesses) {
+        QVector<int> batch;
+        if (!retries.isEmpty()) {
+            batch.append(retries.takeFirst());
+        } else {
+            // Spread what's left over all the processes, so a small drop
+            // still gets probed in parallel.
+            int size = qBound(1, (unsure.count() + maxProcesses - 1) / maxProcesses, MAX_BATCH);
+            while (!unsure.isEmpty() && batch.count() < size)
+                batch.append(unsure.takeFirst());
+        }
+        if (batch.isEmpty())
+            break;
+        QStringList batchFiles;
+        foreach (int index, batch) {
+            batchFiles.append(files.at(index));
+            states[index] = psRunning;
+        }
+        QProcess *process = new QProcess(this);
+        connect(process, SIGNAL(finished(int,QProcess::ExitStatus)), SLOT(process_finished()));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+        connect(process, SIGNAL(errorOccurred(QProcess::ProcessError)), SLOT(process_error(QProcess::ProcessError)));
+#else
+        connect(process, SIGNAL(error(QProcess::ProcessError)), SLOT(process_error(QProcess::ProcessError)));
+#endif
+        connect(process, SIGNAL(readyRead()), SLOT(process_readyRead()));
+        QTimer *timeout = new QTimer(process);
+        timeout->setSingleShot(true);
+        timeout->setInterval(PROBE_TIMEOUT);
+        connect(timeout, SIGNAL(timeout()), process, SLOT(kill()));
+        timeout->start();
+        processes.insert(process, batch);
+        process->start("mpv", batch.count() == 1 ? probeArguments(batchFiles.first())
+                                                 : batchArguments(batchFiles));
+    }
+}
+
+void prober::complete(QProcess *process, bool finished)
+{
+    TRACE_SCOPE("prober::complete");
+    if (!processes.contains(process))
+        return;
+    QVector<int> batch = processes.take(process);
+    QStringList batchFiles;
+    foreach (int index, batch)
+        batchFiles.append(files.at(index));
+    QList<probecache::probe> results = readBatch(batchFiles, finished, process->readAll());
+    for (int i = 0; i < results.count(); i++) {
+        int index = batch.at(i);
+        // A probe that timed out tells us nothing about the file.
+        if (finished || batch.count() > 1)
+            probecache::instance()->insert(files.at(index), results.at(i));
+        states[index] = results.at(i).playable ? psAccepted : psRejected;
+        done++;
+    }
+    for (int i = results.count(); i < batch.count(); i++) {
+        states[batch.at(i)] = psWaiting;
+        retries.append(batch.at(i));
+    }
+    process->disconnect(this);
+    process->deleteLater();
+    startMore();
+    deliver();
+}
+
+void prober::deliver()
+{
+    QStringList ready;
+    while (nextToDeliver < files.count() && states.at(nextToDeliver) != psWaiting
+           && states.at(nextToDeliver) != psRunning) {
+        if (states.at(nextToDeliver) == psAccepted)
+            ready.append(files.at(nextToDeliver));
+        nextToDeliver++;
+    }
+    if (!ready.isEmpty())
+        emit accepted(ready);
+    emit progress(done, files.count());
+    if (nextToDeliver == files.count()) {
+        reset();
+        emit finished();
+    }
+}
+
+void prober::reset()
+{
+    files.clear();
+    states.clear();
+    retries.clear();
+    unsure.clear();
+    nextToCheck = 0;
+    nextToDeliver = 0;
+    done = 0;
+}
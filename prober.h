@@ -0,0 +1,94 @@
+#ifndef PROBER_H
+#define PROBER_H
+
+#include <QObject>
+#include <QProcess>
+#include <QStringList>
+#include <QHash>
+#include <QVector>
+#include <QFutureWatcher>
+#include "probecache.h"
+
+/* Checking dropped files used to happen one mpv at a time, with the gui
+ * sitting in waitForFinished() for each of them.  This class runs several
+ * probes at once instead, without blocking, and hands back the files that
+ * passed in the order they were given to it.  Results that turn up out of
+ * order are held back until everything before them is known, so a drop
+ * lands in the playlist the same way around that it was dragged in.
+ *
+ * Files the sniffer can place from their magic numbers never reach mpv.
+ * Asking the probe cache and the sniffer means going to the disk, which may
+ * be a cold one or on the other side of the network, so that happens on the
+ * thread pool a run of files at a time, and only the verdicts come back.
+ * The rest are handed to mpv a batch at a time, since starting it costs
+ * more than looking at most files does.  mpv announces each file with a
+ * "Playing:" line, which is what the output is split on to get the verdict
+ * for each of them.  Anything a batch didn't get to the end of, because mpv
+ * crashed or went quiet on us, is tried again on its own, so the verdicts
+ * come out the same as probing one file at a time.
+ *
+ * The static functions are the parsing half, kept apart from the processes
+ * so they can be tried on canned mpv output (see tests/prober).
+ */
+
+class prober : public QObject
+{
+    Q_OBJECT
+public:
+    explicit prober(QObject *parent = 0);
+    ~prober();
+
+    // Files given while we are still busy are added to the end of the batch.
+    void probe(const QStringList &files);
+    void cancel();
+    bool isBusy();
+    // Files given to us that haven't been decided yet.
+    int pending();
+    void setMaxProcesses(int count);
+
+    static QStringList probeArguments(const QString &fileName);
+    static probecache::probe readProbe(bool finished, const QString &output);
+    static QStringList batchArguments(const QStringList &files);
+    // Verdicts for as many files from the front of the batch as the output
+    // covers completely.  Whatever comes after those has to be probed again.
+    static QList<probecache::probe> readBatch(const QStringList &files, bool finished, const QString &output);
+
+signals:
+    void accepted(const QStringList &files);
+    void progress(int done, int total);
+    void finished();
+
+private slots:
+    void process_finished();
+    void process_error(QProcess::ProcessError error);
+    void process_readyRead();
+    void precheck_finished();
+
+private:
+    enum probeState { psWaiting, psRunning, psAccepted, psRejected };
+    // What the cache and the sniffer made of a run of files, starting with
+    // files[first].  Those left psWaiting are for mpv to decide.
+    struct precheck {
+        int first;
+        QVector<probeState> states;
+    };
+
+    QStringList files;
+    QVector<probeState> states;
+    QHash<QProcess*, QVector<int> > processes;
+    QList<int> retries;
+    QList<QFutureWatcher<precheck>*> prechecks;
+    QList<int> unsure;  // past the prechecks, waiting for mpv
+    int nextToCheck;
+    int nextToDeliver;
+    int done;
+    int maxProcesses;
+
+    static precheck runPrecheck(int first, const QStringList &files);
+    void startMore();
+    void complete(QProcess *process, bool finished);
+    void deliver();
+    void reset();
+};
+
+#endif // PROBER_H
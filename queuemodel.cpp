@@ -0,0 +1,383 @@
+#include "queuemodel.h"
+#include <algorithm>
+
+queuemodel::queuemodel(QObject *parent) :
+    QAbstractListModel(parent), indexed(false)
+{
+}
+
+int queuemodel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return isFiltered() ? matches.count() : entries.count() - hidden.count();
+}
+
+QVariant queuemodel::data(const QModelIndex &index, int role) const
+{
+    if (role != Qt::DisplayRole || !index.isValid() || index.row() >= rowCount())
+        return QVariant();
+    return searchindex::displayName(entries.handleAt(toQueue(index.row())));
+}
+
+QStringList queuemodel::queue() const
+{
+    return entries.toList();
+}
+
+int queuemodel::count() const
+{
+    return entries.count();
+}
+
+QString queuemodel::at(int index) const
+{
+    return entries.at(index);
+}
+
+bool queuemodel::isMissing(int index) const
+{
+    return std::binary_search(hidden.constBegin(), hidden.constEnd(), index);
+}
+
+bool queuemodel::contains(const QString &path) const
+{
+    return entries.contains(path);
+}
+
+QList<int> queuemodel::indexesOf(const QString &path) const
+{
+    return entries.indexesOf(path);
+}
+
+const QSet<QString> &queuemodel::missingEntries() const
+{
+    return missing;
+}
+
+void queuemodel::setQueue(const QStringList &queue, const QSet<QString> &missing)
+{
+    beginResetModel();
+    entries.setList(queue);
+    this->missing = missing;
+    rehide();
+    // Rebuilt when somebody next filters, or now if they already are.
+    search.clear();
+    indexed = false;
+    if (isFiltered()) {
+        foreach (patharena::handle file, entries.handles())
+            search.add(file);
+        indexed = true;
+    }
+    refilter();
+    endResetModel();
+}
+
+void queuemodel::replace(int first, int count, const QStringList &entries)
+{
+    if (isFiltered()) {
+        beginResetModel();
+        for (int i = 0; i < count; i++) {
+            hiddenRemoved(first);
+            indexRemove(first);
+        }
+        for (int i = 0; i < entries.count(); i++) {
+            this->entries.insert(first + i, entries.at(i));
+            indexAdd(entries.at(i));
+        }
+        hiddenInserted(first, entries);
+        refilter();
+        endResetModel();
+        return;
+    }
+    int firstRow = visibleBefore(first);
+    int removedRows = visibleBefore(first + count) - firstRow;
+    if (count > 0) {
+        if (removedRows > 0)
+            beginRemoveRows(QModelIndex(), firstRow, firstRow + removedRows - 1);
+        for (int i = 0; i < count; i++) {
+            hiddenRemoved(first);
+            indexRemove(first);
+        }
+        if (removedRows > 0)
+            endRemoveRows();
+    }
+    int addedRows = 0;
+    foreach (const QString &path, entries)
+        if (!missing.contains(path))
+            addedRows++;
+    if (addedRows > 0)
+        beginInsertRows(QModelIndex(), firstRow, firstRow + addedRows - 1);
+    for (int i = 0; i < entries.count(); i++) {
+        this->entries.insert(first + i, entries.at(i));
+        indexAdd(entries.at(i));
+    }
+    hiddenInserted(first, entries);
+    if (addedRows > 0)
+        endInsertRows();
+}
+
+void queuemodel::setMissing(const QSet<QString> &missing)
+{
+    // Names don't depend on it, but which entries get a row does.
+    if (missing == this->missing)
+        return;
+    beginResetModel();
+    this->missing = missing;
+    rehide();
+    refilter();
+    endResetModel();
+}
+
+void queuemodel::append(const QStringList &entries)
+{
+    if (entries.isEmpty())
+        return;
+    int first = this->entries.count();
+    if (isFiltered()) {
+        beginResetModel();
+        foreach (const QString &path, entries) {
+            this->entries.append(path);
+            indexAdd(path);
+        }
+        hiddenInserted(first, entries);
+        refilter();
+        endResetModel();
+        return;
+    }
+    int addedRows = 0;
+    foreach (const QString &path, entries)
+        if (!missing.contains(path))
+            addedRows++;
+    if (addedRows > 0)
+        beginInsertRows(QModelIndex(), rowCount(), rowCount() + addedRows - 1);
+    foreach (const QString &path, entries) {
+        this->entries.append(path);
+        indexAdd(path);
+    }
+    hiddenInserted(first, entries);
+    if (addedRows > 0)
+        endInsertRows();
+}
+
+void queuemodel::removeAt(int index)
+{
+    if (isFiltered()) {
+        beginResetModel();
+        hiddenRemoved(index);
+        indexRemove(index);
+        refilter();
+        endResetModel();
+        return;
+    }
+    // A missing entry has no row to take away.
+    int row = toRow(index);
+    if (row >= 0)
+        beginRemoveRows(QModelIndex(), row, row);
+    hiddenRemoved(index);
+    indexRemove(index);
+    if (row >= 0)
+        endRemoveRows();
+}
+
+void queuemodel::move(int from, int to)
+{
+    if (from == to)
+        return;
+    // The index is of files, not places, so it doesn't care.
+    if (isFiltered()) {
+        beginResetModel();
+        hiddenRemoved(from);
+        entries.move(from, to);
+        hiddenInserted(to, QStringList() << entries.at(to));
+        refilter();
+        endResetModel();
+        return;
+    }
+    // Where it lands is counted among the rows that are left once it's out,
+    // and only matters if it has a row at all.
+    int fromRow = toRow(from);
+    hiddenRemoved(from);
+    int landsAt = fromRow >= 0 ? visibleBefore(to) : fromRow;
+    // Qt wants to know which row the moved one ends up in front of, which is
+    // one further along when moving down.
+    bool moves = landsAt != fromRow;
+    if (moves)
+        beginMoveRows(QModelIndex(), fromRow, fromRow, QModelIndex(), landsAt > fromRow ? landsAt + 1 : landsAt);
+    entries.move(from, to);
+    hiddenInserted(to, QStringList() << entries.at(to));
+    if (moves)
+        endMoveRows();
+}
+
+void queuemodel::removeEntries(const QList<int> &indexes)
+{
+    if (indexes.isEmpty())
+        return;
+    beginResetModel();
+    if (indexed)
+        foreach (int index, indexes)
+            search.remove(entries.handleAt(index));
+    entries.removeAll(indexes);
+    rehide();
+    refilter();
+    endResetModel();
+}
+
+QList<int> queuemodel::moveEntries(const QList<int> &indexes, int by)
+{
+    int n = entries.count();
+    int m = indexes.count();
+    by = qBound(-n, by, n);
+    QList<int> targets = indexes;
+    if (by < 0) {
+        for (int i = 0; i < m; i++)
+            targets[i] = qMax(indexes.at(i) + by, i > 0 ? targets.at(i - 1) + 1 : 0);
+    } else {
+        for (int i = m - 1; i >= 0; i--)
+            targets[i] = qMin(indexes.at(i) + by, i < m - 1 ? targets.at(i + 1) - 1 : n - 1);
+    }
+    if (targets == indexes)
+        return targets;
+
+    // The moved entries go where they're told, and the rest fill in the gaps
+    // in the order they were in.
+    QVector<int> from(n, -1);
+    QVector<bool> moving(n, false);
+    for (int i = 0; i < m; i++) {
+        from[targets.at(i)] = indexes.at(i);
+        moving[indexes.at(i)] = true;
+    }
+    int next = 0;
+    for (int i = 0; i < n; i++) {
+        if (from.at(i) >= 0)
+            continue;
+        while (moving.at(next))
+            next++;
+        from[i] = next++;
+    }
+
+    beginResetModel();
+    entries.permute(from);
+    rehide();
+    refilter();
+    endResetModel();
+    return targets;
+}
+
+void queuemodel::setFilter(const QString &text)
+{
+    if (text == filter)
+        return;
+    beginResetModel();
+    filter = text;
+    if (!filter.isEmpty() && !indexed) {
+        foreach (patharena::handle file, entries.handles())
+            search.add(file);
+        indexed = true;
+    }
+    refilter();
+    endResetModel();
+}
+
+bool queuemodel::isFiltered() const
+{
+    return !filter.isEmpty();
+}
+
+int queuemodel::toQueue(int row) const
+{
+    if (isFiltered())
+        return row >= 0 && row < matches.count() ? matches.at(row) : -1;
+    if (row < 0)
+        return -1;
+    // There are hidden[k] - k rows in front of the kth missing entry, so the
+    // row is pushed along by every missing entry with no more rows than that
+    // in front of it.
+    int low = 0;
+    int high = hidden.count();
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (hidden.at(middle) - middle <= row)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return row + low;
+}
+
+int queuemodel::toRow(int index) const
+{
+    if (isFiltered()) {
+        QVector<int>::const_iterator i = std::lower_bound(matches.constBegin(), matches.constEnd(), index);
+        return i != matches.constEnd() && *i == index ? i - matches.constBegin() : -1;
+    }
+    if (index < 0 || isMissing(index))
+        return -1;
+    return visibleBefore(index);
+}
+
+void queuemodel::indexAdd(const QString &path)
+{
+    if (indexed)
+        search.add(patharena::instance()->intern(path));
+}
+
+void queuemodel::indexRemove(int index)
+{
+    if (indexed)
+        search.remove(entries.handleAt(index));
+    entries.removeAt(index);
+}
+
+void queuemodel::refilter()
+{
+    matches.clear();
+    if (!isFiltered())
+        return;
+    foreach (patharena::handle file, search.find(filter))
+        foreach (int index, entries.indexesOf(file))
+            if (!isMissing(index))
+                matches.append(index);
+    std::sort(matches.begin(), matches.end());
+}
+
+void queuemodel::rehide()
+{
+    // Looking each missing file up is cheaper than looking at every entry,
+    // there being far fewer of them as a rule.
+    hidden.clear();
+    foreach (const QString &path, missing)
+        foreach (int index, entries.indexesOf(path))
+            hidden.append(index);
+    std::sort(hidden.begin(), hidden.end());
+}
+
+void queuemodel::hiddenInserted(int index, const QStringList &paths)
+{
+    // paths have just gone in at index; the ones after move along.
+    QVector<int>::iterator i = std::lower_bound(hidden.begin(), hidden.end(), index);
+    for (QVector<int>::iterator j = i; j != hidden.end(); ++j)
+        *j += paths.count();
+    int at = i - hidden.begin();
+    for (int k = 0; k < paths.count(); k++)
+        if (missing.contains(paths.at(k)))
+            hidden.insert(at++, index + k);
+}
+
+bool queuemodel::hiddenRemoved(int index)
+{
+    // The entry at index is about to go; the ones after move back.
+    QVector<int>::iterator i = std::lower_bound(hidden.begin(), hidden.end(), index);
+    bool wasHidden = i != hidden.end() && *i == index;
+    if (wasHidden)
+        i = hidden.erase(i);
+    for (QVector<int>::iterator j = i; j != hidden.end(); ++j)
+        --*j;
+    return wasHidden;
+}
+
+int queuemodel::visibleBefore(int index) const
+{
+    return index - (std::lower_bound(hidden.constBegin(), hidden.constEnd(), index) - hidden.constBegin());
+}
@@ -0,0 +1,89 @@
+#ifndef QUEUEMODEL_H
+#define QUEUEMODEL_H
+
+#include <QAbstractListModel>
+#include <QStringList>
+#include <QSet>
+#include <QVector>
+#include "indexedqueue.h"
+#include "searchindex.h"
+
+/* I held out against model-view for a long time, but reloading a list widget
+ * with a hundred thousand rows every time one of them moves is not something
+ * anyone should have to sit through.  This is about as small as a model gets:
+ * it owns the queue, tells the view exactly which rows changed, and only
+ * works out a row's name when the view asks to paint it.
+ *
+ * Missing entries are part of the queue like any other, but they don't get
+ * a row, so rows aren't the same thing as queue indexes; toQueue() and
+ * toRow() translate.  (Hiding rows in the view instead costs a linear search
+ * of the view's hidden rows per row, which is no good with a lot of them.)
+ * The queue indexes of the missing entries are kept in order, and a row is
+ * found from them by binary search, so an edit costs no more than shifting
+ * the ones after it along.
+ *
+ * With a filter set, the model only shows the entries whose names contain
+ * it.  The search index behind the filter is built the first time it's
+ * needed and kept up to date from then on.  Edits made while filtered just
+ * redo the search, which is cheap, and reset the view.
+ */
+
+class queuemodel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit queuemodel(QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+    QStringList queue() const;
+    int count() const;
+    QString at(int index) const;
+    bool isMissing(int index) const;
+    bool contains(const QString &path) const;
+    QList<int> indexesOf(const QString &path) const;
+    const QSet<QString> &missingEntries() const;
+
+    void setQueue(const QStringList &queue, const QSet<QString> &missing);
+    // Replace count rows from first with entries; the rest stay put.
+    void replace(int first, int count, const QStringList &entries);
+    void setMissing(const QSet<QString> &missing);
+    void append(const QStringList &entries);
+    void removeAt(int index);
+    void move(int from, int to);
+    // Batch edits, each one pass over the queue and one reset of the view.
+    // The indexes have to be sorted.  moveEntries shifts every one of them
+    // by the same amount (negative is up), bunching them up at the ends
+    // rather than letting them pass each other, and says where they went.
+    void removeEntries(const QList<int> &indexes);
+    QList<int> moveEntries(const QList<int> &indexes, int by);
+
+    void setFilter(const QString &text);
+    bool isFiltered() const;
+    int toQueue(int row) const;
+    // The row showing a queue index, or -1 if it's filtered out.
+    int toRow(int index) const;
+
+private:
+    indexedqueue entries;
+    QSet<QString> missing;
+
+    // Queue indexes of the missing entries, lowest first.
+    QVector<int> hidden;
+
+    QString filter;
+    QVector<int> matches;
+    searchindex search;
+    bool indexed;
+
+    void indexAdd(const QString &path);
+    void indexRemove(int index);
+    void refilter();
+    void rehide();
+    void hiddenInserted(int index, const QStringList &paths);
+    bool hiddenRemoved(int index);
+    int visibleBefore(int index) const;
+};
+
+#endif // QUEUEMODEL_H
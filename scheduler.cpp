@@ -0,0 +1,162 @@
+#include "scheduler.h"
+#include <QSettings>
+#include <QThread>
+
+scheduler::scheduler(QObject *parent) :
+    QObject(parent)
+{
+    maxPlaying = qMax(0, QSettings().value("player/concurrent", 1).toInt());
+}
+
+void scheduler::playFile(QObject *owner, const QString &fileName)
+{
+    player *p = playerOf(owner);
+    if (!p) {
+        p = takePlayer();
+        owners.insert(p, owner);
+    }
+    players.removeOne(p);
+    players.append(p);
+    p->playFile(fileName);
+}
+
+void scheduler::stopFile(QObject *owner)
+{
+    player *p = playerOf(owner);
+    if (p)
+        p->stopFile();
+}
+
+void scheduler::setNextFile(QObject *owner, const QString &fileName)
+{
+    player *p = playerOf(owner);
+    if (p)
+        p->setNextFile(fileName);
+}
+
+void scheduler::kill(QObject *owner)
+{
+    player *p = playerOf(owner);
+    if (p)
+        p->kill();
+}
+
+bool scheduler::isPlaying(QObject *owner)
+{
+    player *p = playerOf(owner);
+    return p && p->isPlaying();
+}
+
+void scheduler::release(QObject *owner)
+{
+    player *p = playerOf(owner);
+    if (!p)
+        return;
+    p->stopFile();
+    owners.remove(p);
+}
+
+void scheduler::shareProbes(prober *probes)
+{
+    probers.append(probes);
+    connect(probes, SIGNAL(progress(int,int)), SLOT(probes_activity()));
+    connect(probes, SIGNAL(finished()), SLOT(probes_activity()));
+    connect(probes, SIGNAL(destroyed(QObject*)), SLOT(probes_destroyed(QObject*)));
+}
+
+player *scheduler::playerOf(QObject *owner)
+{
+    return owners.key(owner, NULL);
+}
+
+player *scheduler::takePlayer()
+{
+    // Something already sitting idle, which may well have a warm mpv.
+    foreach (player *p, players) {
+        if (!owners.contains(p))
+            return p;
+    }
+    foreach (player *p, players) {
+        if (!p->isPlaying()) {
+            owners.remove(p);
+            return p;
+        }
+    }
+
+    // Everyone is busy, so either there's room for one more, or the oldest
+    // has to make way.
+    if (maxPlaying == 0 || players.count() < maxPlaying) {
+        player *p = new player(this);
+        connect(p, SIGNAL(playbackFinished(QString)), SLOT(player_playbackFinished(QString)));
+        connect(p, SIGNAL(playbackHalted(QString)), SLOT(player_playbackHalted(QString)));
+        connect(p, SIGNAL(playbackQuit(QString)), SLOT(player_playbackQuit(QString)));
+        connect(p, SIGNAL(playbackBadFile(QString)), SLOT(player_playbackBadFile(QString)));
+        connect(p, SIGNAL(playbackNonstart(QString)), SLOT(player_playbackNonstart(QString)));
+        players.append(p);
+        return p;
+    }
+    player *p = players.first();
+    owners.remove(p);
+    p->stopFile();
+    return p;
+}
+
+QObject *scheduler::ownerOf(QObject *sender)
+{
+    return owners.value(static_cast<player*>(sender), NULL);
+}
+
+void scheduler::player_playbackFinished(const QString &file)
+{
+    QObject *owner = ownerOf(sender());
+    if (owner)
+        emit playbackFinished(owner, file);
+}
+
+void scheduler::player_playbackHalted(const QString &file)
+{
+    QObject *owner = ownerOf(sender());
+    if (owner)
+        emit playbackHalted(owner, file);
+}
+
+void scheduler::player_playbackQuit(const QString &file)
+{
+    QObject *owner = ownerOf(sender());
+    if (owner)
+        emit playbackQuit(owner, file);
+}
+
+void scheduler::player_playbackBadFile(const QString &file)
+{
+    QObject *owner = ownerOf(sender());
+    if (owner)
+        emit playbackBadFile(owner, file);
+}
+
+void scheduler::player_playbackNonstart(const QString &file)
+{
+    QObject *owner = ownerOf(sender());
+    if (owner)
+        emit playbackNonstart(owner, file);
+}
+
+void scheduler::probes_activity()
+{
+    QList<prober*> busy;
+    foreach (prober *probes, probers) {
+        if (probes->isBusy())
+            busy.append(probes);
+    }
+    if (busy.isEmpty())
+        return;
+    int share = qMax(1, QThread::idealThreadCount() / busy.count());
+    foreach (prober *probes, busy)
+        probes->setMaxProcesses(share);
+}
+
+void scheduler::probes_destroyed(QObject *probes)
+{
+    // Only the pointer is of any use by now.
+    probers.removeAll(static_cast<prober*>(probes));
+}
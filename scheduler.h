@@ -0,0 +1,80 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include "player.h"
+#include "prober.h"
+
+/* Every tab used to have a player of its own, so pressing play in three tabs
+ * got you three mpvs fighting over the sound card.  Now the window keeps one
+ * of these, and the tabs ask it to play things for them.
+ *
+ * It keeps a small pool of players, and hands one out to whoever asks.  A
+ * player stays with the tab that last used it, so that the end of the file
+ * (and whatever was queued up after it) still goes back to that tab, until
+ * somebody else needs it.  With player/persistent set, the pool's mpvs are
+ * the only ones kept warm, however many tabs there are.
+ *
+ * player/concurrent says how many files may play at once: 1, the default,
+ * means starting one stops whatever else was playing, and 0 means no limit.
+ * When the limit is reached, the player that was started the longest ago is
+ * stopped and handed over, as quietly as stopFile always has been.
+ *
+ * Outcomes come back through our own signals, along with who asked for the
+ * file, and everyone but the owner is expected to ignore them.
+ *
+ * Tabs still probe dropped files with their own prober, each with its own
+ * processes; there is no pool of them here.  What we do is cap them: every
+ * busy prober may run an even share of one process per core.  That is a
+ * share of at least one, so with more busy tabs than cores the total goes
+ * over, and a prober whose share shrinks keeps what it has running until
+ * those finish.
+ */
+
+class scheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit scheduler(QObject *parent = 0);
+
+    void playFile(QObject *owner, const QString &fileName);
+    void stopFile(QObject *owner);
+    void setNextFile(QObject *owner, const QString &fileName);
+    void kill(QObject *owner);
+    bool isPlaying(QObject *owner);
+    // The owner is going away; whatever it was playing stops.
+    void release(QObject *owner);
+
+    void shareProbes(prober *probes);
+
+signals:
+    void playbackFinished(QObject *owner, const QString &fileJustPlayed);
+    void playbackHalted(QObject *owner, const QString &fileJustPlayed);
+    void playbackQuit(QObject *owner, const QString &fileJustPlayed);
+    void playbackBadFile(QObject *owner, const QString &fileNotPlayed);
+    void playbackNonstart(QObject *owner, const QString &fileNotPlayed);
+
+private slots:
+    void player_playbackFinished(const QString &file);
+    void player_playbackHalted(const QString &file);
+    void player_playbackQuit(const QString &file);
+    void player_playbackBadFile(const QString &file);
+    void player_playbackNonstart(const QString &file);
+    void probes_activity();
+    void probes_destroyed(QObject *probes);
+
+private:
+    int maxPlaying;
+    // Least recently started first.
+    QList<player*> players;
+    QHash<player*, QObject*> owners;
+    QList<prober*> probers;
+
+    player *playerOf(QObject *owner);
+    player *takePlayer();
+    QObject *ownerOf(QObject *sender);
+};
+
+#endif // SCHEDULER_H
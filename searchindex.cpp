@@ -0,0 +1,140 @@
+#include "searchindex.h"
+#include <QFileInfo>
+
+// The longest gram indexed.  Anything longer than this in a query is
+// checked against the name itself.
+static const int GRAM_MAX = 3;
+
+searchindex::searchindex() :
+    unused(0)
+{
+}
+
+void searchindex::clear()
+{
+    postings.clear();
+    files.clear();
+    names.clear();
+    unused = 0;
+}
+
+void searchindex::add(patharena::handle file)
+{
+    QHash<patharena::handle, indexed>::iterator i = files.find(file);
+    if (i != files.end()) {
+        i.value().count++;
+        return;
+    }
+    indexed entry;
+    entry.count = 1;
+    entry.offset = names.length();
+    names.append(displayName(file).toCaseFolded());
+    entry.length = names.length() - entry.offset;
+    files.insert(file, entry);
+    QStringRef folded = foldedName(entry);
+    for (int length = 1; length <= GRAM_MAX; length++)
+        foreach (quint64 key, gramsOf(folded, length))
+            postings[key].insert(file);
+}
+
+void searchindex::remove(patharena::handle file)
+{
+    QHash<patharena::handle, indexed>::iterator i = files.find(file);
+    if (i == files.end() || --i.value().count > 0)
+        return;
+    QStringRef folded = foldedName(i.value());
+    for (int length = 1; length <= GRAM_MAX; length++) {
+        foreach (quint64 key, gramsOf(folded, length)) {
+            QHash<quint64, QSet<patharena::handle> >::iterator posting = postings.find(key);
+            if (posting == postings.end())
+                continue;
+            posting.value().remove(file);
+            if (posting.value().isEmpty())
+                postings.erase(posting);
+        }
+    }
+    unused += i.value().length;
+    files.erase(i);
+    if (unused > names.length() / 2)
+        squeeze();
+}
+
+QList<patharena::handle> searchindex::find(const QString &text) const
+{
+    QString folded = text.toCaseFolded();
+    if (folded.isEmpty())
+        return files.keys();
+    if (folded.length() <= GRAM_MAX) {
+        // The query is a gram of its own, and its posting is the answer.
+        QHash<quint64, QSet<patharena::handle> >::const_iterator posting =
+                postings.constFind(gramKey(folded.constData(), folded.length()));
+        if (posting == postings.constEnd())
+            return QList<patharena::handle>();
+        return posting.value().values();
+    }
+
+    // Start from the rarest trigram and strike off whatever is missing any
+    // of the others.
+    QList<const QSet<patharena::handle>*> sets;
+    foreach (quint64 key, gramsOf(QStringRef(&folded), GRAM_MAX)) {
+        QHash<quint64, QSet<patharena::handle> >::const_iterator posting = postings.constFind(key);
+        if (posting == postings.constEnd())
+            return QList<patharena::handle>();
+        sets.append(&posting.value());
+    }
+    int rarest = 0;
+    for (int i = 1; i < sets.count(); i++)
+        if (sets.at(i)->count() < sets.at(rarest)->count())
+            rarest = i;
+    QList<patharena::handle> matches;
+    foreach (patharena::handle file, *sets.at(rarest)) {
+        bool everywhere = true;
+        for (int i = 0; i < sets.count() && everywhere; i++)
+            everywhere = sets.at(i)->contains(file);
+        if (everywhere && foldedName(files.value(file)).contains(folded))
+            matches.append(file);
+    }
+    return matches;
+}
+
+QString searchindex::displayName(patharena::handle file)
+{
+    return QFileInfo(patharena::instance()->fileName(file)).completeBaseName();
+}
+
+QStringRef searchindex::foldedName(const indexed &file) const
+{
+    return QStringRef(&names, file.offset, file.length);
+}
+
+void searchindex::squeeze()
+{
+    QString packed;
+    packed.reserve(names.length() - unused);
+    QHash<patharena::handle, indexed>::iterator i;
+    for (i = files.begin(); i != files.end(); ++i) {
+        int offset = packed.length();
+        packed.append(foldedName(i.value()));
+        i.value().offset = offset;
+    }
+    names = packed;
+    unused = 0;
+}
+
+quint64 searchindex::gramKey(const QChar *chars, int length)
+{
+    // A trigram takes up 48 bits.  The shorter grams are tagged with their
+    // length above those, so none of them can be mistaken for another.
+    quint64 key = length < GRAM_MAX ? quint64(length) << 48 : 0;
+    for (int i = 0; i < length; i++)
+        key |= quint64(chars[i].unicode()) << (16 * (length - 1 - i));
+    return key;
+}
+
+QSet<quint64> searchindex::gramsOf(const QStringRef &folded, int length)
+{
+    QSet<quint64> keys;
+    for (int i = 0; i + length <= folded.length(); i++)
+        keys.insert(gramKey(folded.constData() + i, length));
+    return keys;
+}
@@ -0,0 +1,56 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QString>
+#include "patharena.h"
+
+/* What the filter box searches: the names shown in the list, by trigram.
+ * Every three characters of every (case folded) name point back at the
+ * files with that name, so a search only has to look at the files that
+ * have all of the query's trigrams, and then check those for real.  Every
+ * single character and pair of characters is indexed the same way, so the
+ * first two keystrokes are a lookup too, and need no checking at all.
+ *
+ * The folded names are kept end to end in one string, so checking a
+ * candidate doesn't mean working its name out again.  Names of files that
+ * have left the index are squeezed out once they make up half of it.
+ *
+ * The index is of files, by arena handle, not of positions in the queue,
+ * so moving entries around doesn't touch it at all.  A file in the queue
+ * twice is counted, and stays in the index until both copies are gone.
+ */
+
+class searchindex
+{
+public:
+    searchindex();
+
+    void clear();
+    void add(patharena::handle file);
+    void remove(patharena::handle file);
+    QList<patharena::handle> find(const QString &text) const;
+
+    // The name a file is shown under in the list.
+    static QString displayName(patharena::handle file);
+
+private:
+    struct indexed {
+        int count;
+        int offset;     // of its folded name in names
+        int length;
+    };
+    QHash<quint64, QSet<patharena::handle> > postings;
+    QHash<patharena::handle, indexed> files;
+    QString names;
+    int unused;         // characters of names no longer in files
+
+    QStringRef foldedName(const indexed &file) const;
+    void squeeze();
+    static quint64 gramKey(const QChar *chars, int length);
+    static QSet<quint64> gramsOf(const QStringRef &folded, int length);
+};
+
+#endif // SEARCHINDEX_H
@@ -0,0 +1,126 @@
+#include "sniffer.h"
+#include <QFile>
+#include <string.h>
+
+// Enough to cover three MPEG-TS packets and most container headers.
+static const int SNIFF_SIZE = 4096;
+
+static bool startsWith(const QByteArray &data, const char *magic, int length, int offset = 0)
+{
+    return data.size() >= offset + length
+            && memcmp(data.constData() + offset, magic, length) == 0;
+}
+
+sniffer::verdict sniffer::sniff(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return svUnknown;   // mpv may know something we don't
+    return sniffHeader(file.read(SNIFF_SIZE), file.size());
+}
+
+sniffer::verdict sniffer::sniffHeader(const QByteArray &header, qint64 fileSize)
+{
+    if (fileSize == 0)
+        return svUnplayable;
+    if (header.isEmpty())
+        return svUnknown;
+
+    // ISO media is mp4, m4a and mov, but phones save their photos in it too.
+    // The major brand says which.  Image sequences might be animations, and
+    // mpv gets to decide on those.
+    if (startsWith(header, "ftyp", 4, 4)) {
+        if (startsWith(header, "heic", 4, 8) || startsWith(header, "heix", 4, 8)
+                || startsWith(header, "heim", 4, 8) || startsWith(header, "heis", 4, 8)
+                || startsWith(header, "mif1", 4, 8) || startsWith(header, "avif", 4, 8))
+            return svUnplayable;
+        if (startsWith(header, "msf1", 4, 8) || startsWith(header, "hevc", 4, 8)
+                || startsWith(header, "hevx", 4, 8) || startsWith(header, "avis", 4, 8))
+            return svUnknown;
+        return svPlayable;
+    }
+
+    // Containers and bare streams that mpv plays.
+    if (startsWith(header, "\x1A\x45\xDF\xA3", 4)           // matroska, webm
+            || startsWith(header, "moov", 4, 4)
+            || startsWith(header, "mdat", 4, 4)
+            || startsWith(header, "OggS", 4)                // vorbis, opus, theora
+            || startsWith(header, "fLaC", 4)
+            || startsWith(header, "ID3", 3)                 // tagged mp3 and friends
+            || startsWith(header, "FLV\x01", 4)
+            || startsWith(header, "\x30\x26\xB2\x75\x8E\x66\xCF\x11", 8)  // asf, wma, wmv
+            || startsWith(header, "\x00\x00\x01\xBA", 4)    // mpeg program stream
+            || startsWith(header, "wvpk", 4)
+            || startsWith(header, "MAC ", 4)                // monkey's audio
+            || startsWith(header, "#!AMR", 5)
+            || startsWith(header, ".RMF", 4))
+        return svPlayable;
+    // Midi is not on the list: ffmpeg has no demuxer for it, so whether it
+    // plays is up to how mpv was built, and mpv gets to say.
+    if (startsWith(header, "RIFF", 4)) {
+        if (startsWith(header, "WAVE", 4, 8) || startsWith(header, "AVI ", 4, 8))
+            return svPlayable;
+        if (startsWith(header, "WEBP", 4, 8))
+            return svUnplayable;
+        return svUnknown;
+    }
+    if (startsWith(header, "FORM", 4) && (startsWith(header, "AIFF", 4, 8) || startsWith(header, "AIFC", 4, 8)))
+        return svPlayable;
+    // MPEG transport streams have a sync byte every 188 bytes, or every 192
+    // in the blu-ray flavour.
+    if (header.size() >= 3 * 188 && header[0] == '\x47' && header[188] == '\x47' && header[376] == '\x47')
+        return svPlayable;
+    if (header.size() >= 3 * 192 && header[4] == '\x47' && header[196] == '\x47' && header[388] == '\x47')
+        return svPlayable;
+
+    // Things which are plainly not for us.
+    if (startsWith(header, "\x89PNG", 4)
+            || startsWith(header, "\xFF\xD8\xFF", 3)         // jpeg
+            || startsWith(header, "GIF8", 4)
+            || (startsWith(header, "BM", 2)                  // bmp, with its reserved bytes
+                && startsWith(header, "\x00\x00\x00\x00", 4, 6))
+            || startsWith(header, "II*\x00", 4)              // tiff
+            || startsWith(header, "MM\x00*", 4)
+            || startsWith(header, "PK\x03\x04", 4)           // zip and its many children
+            || startsWith(header, "Rar!", 4)
+            || startsWith(header, "7z\xBC\xAF\x27\x1C", 6)
+            || startsWith(header, "\x1F\x8B", 2)             // gzip
+            || startsWith(header, "BZh", 3)
+            || startsWith(header, "\xFD" "7zXZ\x00", 6)
+            || startsWith(header, "%PDF", 4)
+            || startsWith(header, "\x7F" "ELF", 4))
+        return svUnplayable;
+
+    // Playlists are text, and mpv is happy to play those.
+    if (startsWith(header, "#EXTM3U", 7) || startsWith(header, "[playlist]", 10))
+        return svUnknown;
+    if (looksLikeText(header))
+        return svUnplayable;
+
+    // Bare mp3, aac and ac3 frames have short sync words that turn up in all
+    // sorts of binary data, so those are left to mpv.
+    return svUnknown;
+}
+
+bool sniffer::looksLikeText(const QByteArray &header)
+{
+    // No control characters other than whitespace, and the bytes above 0x7f
+    // arranged the way UTF-8 has them.  A sequence cut off by the end of
+    // the header is given the benefit of the doubt.
+    int i = 0;
+    while (i < header.size()) {
+        unsigned char c = header[i];
+        if (c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f')
+            return false;
+        if (c == 0x7f)
+            return false;
+        int follow = c < 0x80 ? 0 : (c & 0xE0) == 0xC0 ? 1 : (c & 0xF0) == 0xE0 ? 2 : (c & 0xF8) == 0xF0 ? 3 : -1;
+        if (follow < 0)
+            return false;
+        for (int j = 1; j <= follow && i + j < header.size(); j++)
+            if ((header[i + j] & 0xC0) != 0x80)
+                return false;
+        i += follow + 1;
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef SNIFFER_H
+#define SNIFFER_H
+
+#include <QString>
+
+/* Most of what gets rejected when a folder is dropped on us is obvious from
+ * its first few bytes: cover art, text files, the odd archive.  Starting mpv
+ * to tell us so is a waste, so we look at the magic numbers ourselves first.
+ * Only files we can't place either way are left for mpv to decide.  What
+ * the sniffer makes of some real headers is in tests/sniffer.
+ */
+
+class sniffer
+{
+public:
+    enum verdict { svPlayable, svUnplayable, svUnknown };
+
+    static verdict sniff(const QString &fileName);
+
+private:
+    sniffer();
+    static verdict sniffHeader(const QByteArray &header, qint64 fileSize);
+    static bool looksLikeText(const QByteArray &header);
+};
+
+#endif // SNIFFER_H
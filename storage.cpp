@@ -1,23 +1,91 @@
 #include "storage.h"
+#include "validator.h"
+#include "writer.h"
+#include "tracer.h"
 #include <QSettings>
 #include <QFileInfo>
 #include <QTextStream>
 #include <QDirIterator>
+#include <QSaveFile>
+#include <QLockFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QtConcurrent>
+#include <cstring>
+#include <cctype>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
 
 static const QString TAB_FILE("tabs.txt");
+static const QString SNAPSHOT_FILE("snapshot.bin");
+static const quint32 SNAPSHOT_MAGIC = 0x4d504c53;  // "MPLS"
+static const quint32 SNAPSHOT_VERSION = 1;
+static const QString JOURNAL_SUFFIX(".journal");
+static const QString OLD_JOURNAL_SUFFIX(".journal.old");
+static const QString LOCK_SUFFIX(".lock");
+static const QString GENERATION_TAG("#MPLAYLIST-GENERATION:");
+static const QString JOURNAL_TAG("#MPLAYLIST-JOURNAL:");
+
+// How long to let a burst of filesystem events settle, in milliseconds.
+static const int RESCAN_DELAY = 300;
+
+// How long to wait for whoever else is writing a playlist, in milliseconds.
+// Writes take nowhere near this long, so anything longer is somebody stuck.
+static const int LOCK_TIMEOUT = 5000;
 
 
 storage::storage(QObject *parent) :
-    QObject(parent)
+    QObject(parent), snapshotReader(NULL), enumeration(NULL), reloads(NULL),
+    requests(NULL)
 {
     fetchConfigPath();
+    playlistWriter = new writer(this);
+    playlistWriter->moveToThread(&writerThread);
+    writerThread.setObjectName("writer");
+    connect(&writerThread, SIGNAL(finished()), playlistWriter, SLOT(deleteLater()));
+    connect(playlistWriter, SIGNAL(writeFailed(QString,int)), SLOT(writer_writeFailed(QString,int)));
+    connect(playlistWriter, SIGNAL(playlistWritten(QString)), SLOT(writer_playlistWritten(QString)));
+    writerThread.start();
+
+    // Bursts of events, such as a script rewriting a dozen playlists, are
+    // gathered up into a single rescan.
+    rescanTimer = new QTimer(this);
+    rescanTimer->setSingleShot(true);
+    rescanTimer->setInterval(RESCAN_DELAY);
+    connect(rescanTimer, SIGNAL(timeout()), SLOT(rescan()));
+    dirWatcher = new QFileSystemWatcher(this);
+    connect(dirWatcher, SIGNAL(directoryChanged(QString)), SLOT(dirWatcher_changed()));
+    connect(dirWatcher, SIGNAL(fileChanged(QString)), SLOT(dirWatcher_changed()));
+}
+
+storage::~storage()
+{
+    if (snapshotReader)
+        snapshotReader->waitForFinished();
+    if (enumeration)
+        enumeration->waitForFinished();
+    if (reloads)
+        reloads->waitForFinished();
+    if (requests)
+        requests->waitForFinished();
+    snapshotWriter.waitForFinished();
+    // Nothing the user did may be lost on the way out.
+    QMetaObject::invokeMethod(playlistWriter, "flush", Qt::BlockingQueuedConnection);
+    writerThread.quit();
+    writerThread.wait();
 }
 
 storage::storeReturns storage::addPlaylist(const QString &title, const QStringList &entries)
 {
+    QLockFile lock(lockToPath(title));
+    if (!lockPlaylist(lock))
+        return srWriteFailed;
     if (playlistAlreadyExists(title))
         return srAlreadyExists;
-    return writeEntriesToFile(playlistToPath(title), entries);
+    storeReturns ret = commitEntriesToFile(playlistToPath(title), entries, 0);
+    known.insert(title, stampPlaylist(title));
+    return ret;
 }
 
 storage::storeReturns storage::renamePlaylist(const QString &oldTitle, const QString &newTitle)
@@ -25,8 +93,20 @@ storage::storeReturns storage::renamePlaylist(const QString &oldTitle, const QSt
     QFile file(playlistToPath(oldTitle));
     if (!file.exists())
         return srNoLongerExists;  // sneakily removed by the user.  bad user!
+    // Renaming and removing are rare enough that we can afford to wait for
+    // the writer to finish with the playlist first.
+    QMetaObject::invokeMethod(playlistWriter, "flushPlaylist", Qt::BlockingQueuedConnection,
+                              Q_ARG(QString, oldTitle));
+    QLockFile lock(lockToPath(oldTitle));
+    if (!lockPlaylist(lock))
+        return srRenameFailed;
     if (!file.rename(playlistToPath(newTitle)))
         return srRenameFailed;  // this is probably a filesystem/permission error
+    QFile::rename(journalToPath(oldTitle), journalToPath(newTitle));
+    QMetaObject::invokeMethod(playlistWriter, "forgetPlaylist", Q_ARG(QString, oldTitle));
+    known.remove(oldTitle);
+    snapshot.playlists.remove(oldTitle);
+    known.insert(newTitle, stampPlaylist(newTitle));
     return srSuccess;
 }
 
@@ -35,8 +115,17 @@ storage::storeReturns storage::removePlaylist(const QString &title)
     QFile file(playlistToPath(title));
     if (!file.exists())
         return srNoLongerExists;
+    QMetaObject::invokeMethod(playlistWriter, "flushPlaylist", Qt::BlockingQueuedConnection,
+                              Q_ARG(QString, title));
+    QLockFile lock(lockToPath(title));
+    if (!lockPlaylist(lock))
+        return srRemoveFailed;
     if (!file.remove())
         return srRemoveFailed;
+    QFile::remove(journalToPath(title));
+    QMetaObject::invokeMethod(playlistWriter, "forgetPlaylist", Q_ARG(QString, title));
+    known.remove(title);
+    snapshot.playlists.remove(title);
     return srSuccess;
 }
 
@@ -49,36 +138,258 @@ storage::storeReturns storage::importPlaylist(const QString &filePath, const QSt
 
 storage::storeReturns storage::exportPlaylist(const QString &filePath, const QStringList &entries)
 {
-    return writeEntriesToFile(filePath, entries);
+    // Written the same way as our own playlists, so that whatever was at
+    // filePath before isn't lost if the write fails halfway.
+    return commitEntriesToFile(filePath, entries, -1);
 }
 
 storage::storeReturns storage::updatePlaylist(const QString &title, const QStringList &entries)
 {
-    return writeEntriesToFile(playlistToPath(title), entries);
+    // Edits are handed to the writer thread, so we can't know yet whether
+    // they will make it.  If they don't, we hear about it via writeFailed.
+    QMetaObject::invokeMethod(playlistWriter, "writePlaylist",
+                              Q_ARG(QString, title), Q_ARG(QStringList, entries));
+    return srSuccess;
 }
 
-void storage::enumPlaylists()
+storage::storeReturns storage::appendEntries(const QString &title, const QStringList &added)
 {
-    // We start with two lists: whats on the disk and the tab order from last
-    // time.  So we merge the two, and load whatever playlists we can find.
-    QStringList allLists;
-    QStringList savedLists = readTabs();
-    foreach (const QString &s, savedLists) {
-        allLists.append(s + ".m3u");
+    QString records;
+    foreach (const QString &s, added)
+        records.append(QString("+%1\n").arg(s));
+    return writeJournal(title, records);
+}
+
+void storage::writer_writeFailed(const QString &title, int why)
+{
+    emit writeFailed(title, static_cast<storeReturns>(why));
+}
+
+void storage::writer_playlistWritten(const QString &title)
+{
+    if (known.contains(title))
+        known.insert(title, stampPlaylist(title));
+}
+
+void storage::dirWatcher_changed()
+{
+    rescanTimer->start();
+}
+
+void storage::rescan()
+{
+    TRACE_SCOPE("storage::rescan");
+    // Wait for enumeration or the last reload to finish; they will look at
+    // the files again themselves anyway.
+    if (loading()) {
+        rescanTimer->start();
+        return;
     }
+
+    // Files that get replaced by a rename lose their watch, so look over
+    // the list each time.
     QStringList storedLists = QDir(configPath).entryList(QStringList() << "*.m3u");
-    allLists.append(storedLists);
-    allLists.removeDuplicates();
+    QStringList watched = dirWatcher->files();
+    QStringList unwatched;
+    QStringList titles;
+    foreach (const QString &s, storedLists) {
+        QString path = configPath + s;
+        if (!watched.contains(path))
+            unwatched.append(path);
+        QString title = QFileInfo(s).completeBaseName();
+        titles.append(title);
+        if (!known.contains(title) || !(known.value(title) == stampPlaylist(title)))
+            reloadQueue.append(title);
+    }
+    if (!unwatched.isEmpty())
+        dirWatcher->addPaths(unwatched);
+    foreach (const QString &title, known.keys()) {
+        if (!titles.contains(title)) {
+            known.remove(title);
+            snapshot.playlists.remove(title);
+            emit playlistVanished(title);
+        }
+    }
+    if (reloadQueue.isEmpty())
+        return;
 
-    QDir configDir(configPath);
-    QFileInfo info;
-    QStringList entries;
-    foreach (const QString &s, allLists) {
-        info.setFile(configDir.filePath(s));
-        if (entriesFromPlaylist(info.absoluteFilePath(), entries))
-            emit playlistFound(info.completeBaseName(), entries);
+    // Whatever we still have to write for these goes down first, otherwise
+    // it would be written over what we are about to read.
+    foreach (const QString &title, reloadQueue)
+        QMetaObject::invokeMethod(playlistWriter, "flushPlaylist", Qt::BlockingQueuedConnection,
+                                  Q_ARG(QString, title));
+    if (!reloads) {
+        reloads = new QFutureWatcher<loadedPlaylist>(this);
+        connect(reloads, SIGNAL(resultReadyAt(int)), SLOT(reloads_resultReadyAt(int)));
+        connect(reloads, SIGNAL(finished()), SLOT(reloads_finished()));
     }
-    emit finishedEnumerating();
+    reloads->setFuture(QtConcurrent::mapped(reloadQueue, playlistLoader(this, snapshotData(), true)));
+    reloadQueue.clear();
+}
+
+void storage::reloads_resultReadyAt(int index)
+{
+    loadedPlaylist loaded = reloads->resultAt(index);
+    if (!loaded.ok)
+        return;  // probably caught half way through being written
+    // Loading may have folded a journal into a new generation.
+    QMetaObject::invokeMethod(playlistWriter, "forgetGeneration", Q_ARG(QString, loaded.title));
+    bool isNew = !known.contains(loaded.title);
+    known.insert(loaded.title, loaded.stamp);
+    snapshot.playlists.remove(loaded.title);
+    if (isNew)
+        emit playlistFound(loaded.title, loaded.entries.count());
+    else
+        emit playlistChanged(loaded.title, loaded.entries, loaded.missing);
+}
+
+void storage::reloads_finished()
+{
+    if (!requestQueue.isEmpty())
+        startRequests();
+    // Anything which turned up while we were busy.
+    if (rescanTimer->isActive() || loading())
+        return;
+    rescan();
+}
+
+void storage::requestPlaylist(const QString &title)
+{
+    if (!requestQueue.contains(title))
+        requestQueue.append(title);
+    if (!requestsWaiting())
+        startRequests();
+}
+
+QStringList storage::listPlaylists()
+{
+    QStringList titles;
+    foreach (const QString &s, orderedPlaylists(readTabs()))
+        titles.append(QFileInfo(s).completeBaseName());
+    return titles;
+}
+
+storage::storeReturns storage::readPlaylist(const QString &title, QStringList &entries)
+{
+    TRACE_SCOPE("storage::readPlaylist", title);
+    if (!playlistAlreadyExists(title))
+        return srNoLongerExists;
+    QMetaObject::invokeMethod(playlistWriter, "flushPlaylist", Qt::BlockingQueuedConnection,
+                              Q_ARG(QString, title));
+    qint64 generation;
+    if (!loadPlaylist(title, entries, generation))
+        return srReadFailed;
+    QMetaObject::invokeMethod(playlistWriter, "forgetGeneration", Q_ARG(QString, title));
+    known.insert(title, stampPlaylist(title));
+    return srSuccess;
+}
+
+storage::storeReturns storage::peekPlaylist(const QString &title, QStringList &entries)
+{
+    TRACE_SCOPE("storage::peekPlaylist", title);
+    if (!playlistAlreadyExists(title))
+        return srNoLongerExists;
+    QMetaObject::invokeMethod(playlistWriter, "flushPlaylist", Qt::BlockingQueuedConnection,
+                              Q_ARG(QString, title));
+    qint64 generation;
+    return loadPlaylist(title, entries, generation, false) ? srSuccess : srReadFailed;
+}
+
+void storage::flush()
+{
+    QMetaObject::invokeMethod(playlistWriter, "flush", Qt::BlockingQueuedConnection);
+}
+
+bool storage::loading()
+{
+    return !enumeration || !enumeration->isFinished()
+            || (reloads && !reloads->isFinished())
+            || (requests && !requests->isFinished());
+}
+
+bool storage::requestsWaiting()
+{
+    if ((reloads && !reloads->isFinished()) || (requests && !requests->isFinished()))
+        return true;
+    if (!enumeration)
+        return true;
+    if (enumeration->isFinished())
+        return false;
+    // Enumeration is done with a playlist once it has been found, so only
+    // those it has yet to get to have to wait for it.  This way the tab on
+    // show at startup doesn't wait for all the others.
+    foreach (const QString &title, requestQueue)
+        if (!known.contains(title))
+            return true;
+    return false;
+}
+
+void storage::startRequests()
+{
+    // The same dance as rescan: whatever is still to be written goes down
+    // before we read it back.
+    foreach (const QString &title, requestQueue)
+        QMetaObject::invokeMethod(playlistWriter, "flushPlaylist", Qt::BlockingQueuedConnection,
+                                  Q_ARG(QString, title));
+    if (!requests) {
+        requests = new QFutureWatcher<loadedPlaylist>(this);
+        connect(requests, SIGNAL(resultReadyAt(int)), SLOT(requests_resultReadyAt(int)));
+        connect(requests, SIGNAL(finished()), SLOT(requests_finished()));
+    }
+    requests->setFuture(QtConcurrent::mapped(requestQueue, playlistLoader(this, snapshot, true)));
+    requestQueue.clear();
+}
+
+void storage::requests_resultReadyAt(int index)
+{
+    loadedPlaylist loaded = requests->resultAt(index);
+    if (!loaded.ok) {
+        emit playlistUnreadable(loaded.title);
+        return;
+    }
+    QMetaObject::invokeMethod(playlistWriter, "forgetGeneration", Q_ARG(QString, loaded.title));
+    known.insert(loaded.title, loaded.stamp);
+    snapshot.playlists.remove(loaded.title);
+    emit playlistLoaded(loaded.title, loaded.entries, loaded.missing);
+}
+
+void storage::requests_finished()
+{
+    // Let go of the entries; the tabs have their own copies now.
+    requests->setFuture(QFuture<loadedPlaylist>());
+    if (!requestQueue.isEmpty() && !requestsWaiting())
+        startRequests();
+    else if (!rescanTimer->isActive())
+        rescan();
+}
+
+storage::storeReturns storage::removeEntry(const QString &title, int index)
+{
+    return writeJournal(title, QString("-%1\n").arg(index));
+}
+
+storage::storeReturns storage::removeEntries(const QString &title, const QList<int> &indexes)
+{
+    // Last first, so that each record still means what it says by the time
+    // it is replayed.
+    QString records;
+    for (int i = indexes.count() - 1; i >= 0; i--)
+        records.append(QString("-%1\n").arg(indexes.at(i)));
+    return writeJournal(title, records);
+}
+
+storage::storeReturns storage::moveEntry(const QString &title, int from, int to)
+{
+    return writeJournal(title, QString(">%1 %2\n").arg(from).arg(to));
+}
+
+void storage::enumPlaylists()
+{
+    TRACE_SCOPE("storage::enumPlaylists");
+    // The snapshot is read first, off the gui thread, as it may be large.
+    snapshotReader = new QFutureWatcher<snapshotData>(this);
+    connect(snapshotReader, SIGNAL(finished()), SLOT(snapshotReader_finished()));
+    snapshotReader->setFuture(QtConcurrent::run(&storage::readSnapshot, snapshotPath()));
 }
 
 void storage::saveTabs(const QStringList &tabs)
@@ -86,6 +397,47 @@ void storage::saveTabs(const QStringList &tabs)
     writeTabs(tabs);
 }
 
+void storage::saveSnapshot(const QStringList &titles, const QList<QStringList> &queues,
+                           const QStringList &unloaded)
+{
+    TRACE_SCOPE("storage::saveSnapshot");
+    // The stamps have to describe the files as they will be left, so let
+    // everything else finish writing first.
+    QMetaObject::invokeMethod(playlistWriter, "flush", Qt::BlockingQueuedConnection);
+    snapshotWriter.waitForFinished();
+
+    snapshotData saved;
+    saved.tabs = titles;
+    for (int i = 0; i < titles.count() && i < queues.count(); i++) {
+        if (unloaded.contains(titles.at(i)))
+            continue;
+        snapshotEntry &entry = saved.playlists[titles.at(i)];
+        entry.stamp = stampPlaylist(titles.at(i));
+        entry.generation = playlistWriter->generation(titles.at(i));
+        entry.entries = queues.at(i);
+    }
+    // Tabs that were never opened are still in what enumeration read.  Those
+    // that were opened and put away again may still be in the last file.
+    snapshotData previous;
+    bool previousRead = false;
+    foreach (const QString &title, unloaded) {
+        QHash<QString, snapshotEntry>::const_iterator old = snapshot.playlists.constFind(title);
+        if (old == snapshot.playlists.constEnd()) {
+            if (!previousRead) {
+                previous = readSnapshot(snapshotPath());
+                previousRead = true;
+            }
+            old = previous.playlists.constFind(title);
+            if (old == previous.playlists.constEnd())
+                continue;
+        }
+        if (!(old->stamp == stampPlaylist(title)))
+            continue;  // it will just have to be parsed next time
+        saved.playlists.insert(title, *old);
+    }
+    writeSnapshot(snapshotPath(), saved);
+}
+
 void storage::fetchConfigPath()
 {
     QSettings::setDefaultFormat(QSettings::IniFormat);
@@ -95,23 +447,8 @@ void storage::fetchConfigPath()
 
 bool storage::entriesFromPlaylist(const QString &filePath, QStringList &entries)
 {
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
-        return false;
-    QTextStream qts(&file);
-    entries = entriesFromM3U(qts.readAll().split('\n'));
-    return true;
-}
-
-storage::storeReturns storage::writeEntriesToFile(const QString &filePath, const QStringList &entries)
-{
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadWrite | QIODevice::Text))
-        return srWriteFailed;
-    file.resize(0);
-    QTextStream qts(&file);
-    qts << entriesToM3U(entries).join('\n');
-    return srSuccess;
+    qint64 generation;
+    return entriesFromM3U(filePath, entries, generation);
 }
 
 bool storage::playlistAlreadyExists(const QString &title)
@@ -125,7 +462,22 @@ QStringList storage::readTabs()
     QFile file(QDir(configPath).absoluteFilePath(TAB_FILE));
     if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
         return QStringList();
-    return QTextStream(&file).readAll().split('\n');
+    QTextStream qts(&file);
+    qts.setCodec("UTF-8");
+    return qts.readAll().split('\n');
+}
+
+QStringList storage::orderedPlaylists(const QStringList &savedLists)
+{
+    QStringList allLists;
+    QStringList storedLists = QDir(configPath).entryList(QStringList() << "*.m3u");
+    foreach (const QString &s, savedLists) {
+        if (storedLists.contains(s + ".m3u"))
+            allLists.append(s + ".m3u");
+    }
+    allLists.append(storedLists);
+    allLists.removeDuplicates();
+    return allLists;
 }
 
 void storage::writeTabs(const QStringList &tabs)
@@ -133,30 +485,436 @@ void storage::writeTabs(const QStringList &tabs)
     QFile file(QDir(configPath).absoluteFilePath(TAB_FILE));
     if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
         return;
-    QTextStream(&file) << tabs.join('\n');
+    QTextStream qts(&file);
+    qts.setCodec("UTF-8");
+    qts << tabs.join('\n');
 }
 
-QStringList storage::entriesToM3U(const QStringList &entries)
+QStringList storage::entriesToM3U(const QStringList &entries, qint64 generation)
 {
-    return QStringList() << "#EXTM3U" << entries;
+    // Exported playlists have no business carrying our generation tag.
+    if (generation < 0)
+        return QStringList() << "#EXTM3U" << entries;
+    return QStringList() << "#EXTM3U" << GENERATION_TAG + QString::number(generation) << entries;
 }
 
-QStringList storage::entriesFromM3U(QStringList M3U)
+bool storage::entriesFromM3U(const QString &filePath, QStringList &entries, qint64 &generation)
 {
-    QStringList items;
-    items.clear();
-    foreach(QString s, M3U) {
-        s = s.trimmed();
-        if (s.isEmpty() || s[0] == '#')
-            continue;
-        if (QFileInfo(s).exists())
-           items.append(s);
+    TRACE_SCOPE("storage::entriesFromM3U", filePath);
+    // Large playlists used to be read into one string, split into another
+    // list of strings, and then trimmed into a third.  Instead we map the
+    // file and walk it in place with memchr (which libc vectorizes for us),
+    // and only the entries themselves are ever decoded into QStrings.
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    entries.clear();
+    generation = 0;
+    qint64 size = file.size();
+    if (size == 0)
+        return true;
+    const char *data = reinterpret_cast<const char*>(file.map(0, size));
+    QByteArray contents;
+    if (!data) {
+        // Not everything can be mapped, so fall back to a plain read.
+        contents = file.readAll();
+        data = contents.constData();
+        size = contents.size();
     }
-    return items;
+    const char *end = data + size;
+    if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+        data += 3;  // byte order mark
+
+    static const QByteArray tag = GENERATION_TAG.toUtf8();
+    while (data < end) {
+        const char *eol = static_cast<const char*>(memchr(data, '\n', end - data));
+        if (!eol)
+            eol = end;
+        const char *first = data;
+        const char *last = eol;
+        while (first < last && isspace(static_cast<unsigned char>(*first)))
+            first++;
+        while (last > first && isspace(static_cast<unsigned char>(last[-1])))
+            last--;
+        int length = last - first;
+        if (length > 0 && *first != '#')
+            entries.append(QString::fromUtf8(first, length));
+        else if (length > tag.size() && memcmp(first, tag.constData(), tag.size()) == 0)
+            generation = QByteArray(first + tag.size(), length - tag.size()).toLongLong();
+        data = eol + 1;
+    }
+    return true;
 }
 
-QString storage::playlistToPath(const QString &title)
+QString storage::playlistToPath(const QString &title) const
 {
     return QString("%1%2.m3u").arg(configPath,title);
 }
 
+QString storage::journalToPath(const QString &title) const
+{
+    return QString("%1%2%3").arg(configPath, title, JOURNAL_SUFFIX);
+}
+
+QString storage::lockToPath(const QString &title) const
+{
+    return QString("%1%2%3").arg(configPath, title, LOCK_SUFFIX);
+}
+
+bool storage::lockPlaylist(QLockFile &lock)
+{
+    return lock.tryLock(LOCK_TIMEOUT);
+}
+
+QString storage::snapshotPath() const
+{
+    return configPath + SNAPSHOT_FILE;
+}
+
+storage::playlistStamp storage::stampPlaylist(const QString &title) const
+{
+    playlistStamp stamp;
+    QFileInfo m3u(playlistToPath(title));
+    QFileInfo journal(journalToPath(title));
+    stamp.m3uSize = m3u.exists() ? m3u.size() : -1;
+    stamp.m3uModified = m3u.exists() ? m3u.lastModified().toMSecsSinceEpoch() : -1;
+    stamp.journalSize = journal.exists() ? journal.size() : -1;
+    stamp.journalModified = journal.exists() ? journal.lastModified().toMSecsSinceEpoch() : -1;
+    // Half way through a compaction is no state to be caching.
+    if (QFile::exists(configPath + title + OLD_JOURNAL_SUFFIX))
+        stamp.m3uSize = -1;
+    return stamp;
+}
+
+storage::snapshotData storage::readSnapshot(const QString &filePath)
+{
+    TRACE_SCOPE("storage::readSnapshot");
+    // Anything odd about the snapshot just means we parse everything.
+    snapshotData snapshot;
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return snapshot;
+    QDataStream ds(&file);
+    ds.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version, count;
+    ds >> magic >> version;
+    if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION)
+        return snapshot;
+    ds >> snapshot.tabs >> count;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; i++) {
+        QString title;
+        snapshotEntry entry;
+        ds >> title >> entry.stamp.m3uSize >> entry.stamp.m3uModified
+           >> entry.stamp.journalSize >> entry.stamp.journalModified
+           >> entry.generation >> entry.entries;
+        snapshot.playlists.insert(title, entry);
+    }
+    if (ds.status() != QDataStream::Ok)
+        return snapshotData();
+    return snapshot;
+}
+
+void storage::writeSnapshot(const QString &filePath, const snapshotData &snapshot)
+{
+    TRACE_SCOPE("storage::writeSnapshot");
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    QDataStream ds(&file);
+    ds.setVersion(QDataStream::Qt_5_0);
+    ds << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << snapshot.tabs
+       << quint32(snapshot.playlists.count());
+    QHash<QString, snapshotEntry>::const_iterator i;
+    for (i = snapshot.playlists.constBegin(); i != snapshot.playlists.constEnd(); ++i) {
+        ds << i.key() << i->stamp.m3uSize << i->stamp.m3uModified
+           << i->stamp.journalSize << i->stamp.journalModified
+           << i->generation << i->entries;
+    }
+    if (ds.status() == QDataStream::Ok)
+        file.commit();
+}
+
+bool storage::playlistStamp::operator==(const playlistStamp &other) const
+{
+    return m3uSize == other.m3uSize && m3uModified == other.m3uModified
+            && journalSize == other.journalSize && journalModified == other.journalModified;
+}
+
+storage::loadedPlaylist storage::playlistLoader::operator()(const QString &title)
+{
+    TRACE_SCOPE("storage::playlistLoader", title);
+    loadedPlaylist loaded;
+    loaded.title = title;
+    loaded.stamp = store->stampPlaylist(title);
+    QHash<QString, snapshotEntry>::const_iterator cached = snapshot.playlists.constFind(title);
+    loaded.cached = loaded.stamp.m3uSize >= 0 && cached != snapshot.playlists.constEnd()
+            && cached->stamp == loaded.stamp;
+    if (loaded.cached) {
+        loaded.entries = cached->entries;
+        loaded.generation = cached->generation;
+        loaded.ok = true;
+    } else {
+        loaded.ok = store->loadPlaylist(title, loaded.entries, loaded.generation);
+        // Loading may have folded in a journal, so look again.
+        loaded.stamp = store->stampPlaylist(title);
+    }
+    // Media comes and goes without touching the playlist, so the snapshot
+    // is no help here.  The validator's own cache is.
+    if (loaded.ok && validate)
+        loaded.missing = validator::missingEntries(loaded.entries);
+    return loaded;
+}
+
+bool storage::loadPlaylist(const QString &title, QStringList &entries, qint64 &generation,
+                           bool fold) const
+{
+    // This runs on a pooled thread during enumeration, so it must not touch
+    // anything but the files of the playlist it was given.
+    QString journal = journalToPath(title);
+    QString oldJournal = configPath + title + OLD_JOURNAL_SUFFIX;
+
+    // Folding rewrites the m3u, so nobody else may write it between our
+    // reading it and that.  Most playlists have no journal, and aren't worth
+    // a lock file.  If somebody is hogging the lock, we read what's there
+    // and leave the folding for next time.
+    QLockFile lock(lockToPath(title));
+    if (fold && (QFile::exists(journal) || QFile::exists(oldJournal)))
+        fold = lockPlaylist(lock);
+
+    if (!entriesFromM3U(playlistToPath(title), entries, generation))
+        return false;
+    bool dirty = false;
+    if (QFile::exists(oldJournal)) {
+        // Earlier builds compacted by renaming the journal aside first.  If
+        // that compaction never finished, the old journal still applies and
+        // takes us to the next generation.
+        if (replayJournal(oldJournal, playlistToPath(title), generation, entries))
+            generation++;
+        dirty = true;
+    }
+    if (QFile::exists(journal)) {
+        replayJournal(journal, playlistToPath(title), generation, entries);
+        dirty = true;
+    }
+
+    // Fold the journals in now, so the session starts without one and any
+    // new records are written against a generation we know about.  A
+    // journal that didn't apply, because the m3u was changed under it, is
+    // dropped all the same.
+    if (dirty && fold) {
+        generation++;
+        if (commitEntriesToFile(playlistToPath(title), entries, generation) == srSuccess) {
+            QFile::remove(journal);
+            QFile::remove(oldJournal);
+        }
+    }
+    return true;
+}
+
+storage::storeReturns storage::writeJournal(const QString &title, const QString &records)
+{
+    QMetaObject::invokeMethod(playlistWriter, "appendRecords", Q_ARG(QString, title),
+                              Q_ARG(QString, records));
+    return srSuccess;
+}
+
+storage::storeReturns storage::commitEntriesToFile(const QString &filePath, const QStringList &entries, qint64 generation)
+{
+    TRACE_SCOPE("storage::commitEntriesToFile", filePath);
+    // Write to a temporary file and rename it over the playlist, so that the
+    // playlist on disk is always either the old one or the new one.
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return srWriteFailed;
+    QTextStream qts(&file);
+    qts.setCodec("UTF-8");
+    qts << entriesToM3U(entries, generation).join('\n');
+    qts.flush();
+    if (qts.status() != QTextStream::Ok)
+        return srWriteFailed;
+#ifdef Q_OS_UNIX
+    if (!file.flush() || fsync(file.handle()) != 0)
+        return srWriteFailed;
+#endif
+    return file.commit() ? srSuccess : srWriteFailed;
+}
+
+qint64 storage::appendToJournal(const QString &filePath, const QString &m3uPath, qint64 generation,
+                                qint64 sizeBefore, const QString &records)
+{
+    // Whatever is past sizeBefore is what's left of an append that failed
+    // part way, and would be replayed twice if it stayed.
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        return -1;
+    if (file.size() > sizeBefore && !file.resize(sizeBefore))
+        return -1;
+    QTextStream qts(&file);
+    qts.setCodec("UTF-8");
+    if (file.size() == 0)
+        qts << journalHeader(m3uPath, generation) << '\n';
+    qts << records;
+    qts.flush();
+    if (qts.status() != QTextStream::Ok) {
+        file.resize(sizeBefore);
+        return -1;
+    }
+    return file.size();
+}
+
+qint64 storage::generationOfM3U(const QString &filePath)
+{
+    // The tag sits right after the header, so there's no need to read on
+    // past the first entry.
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return 0;
+    while (!file.atEnd()) {
+        QString line = QString::fromUtf8(file.readLine()).trimmed();
+        if (line.startsWith(GENERATION_TAG))
+            return line.mid(GENERATION_TAG.length()).toLongLong();
+        if (!line.isEmpty() && line[0] != '#')
+            break;
+    }
+    return 0;
+}
+
+QString storage::journalHeader(const QString &m3uPath, qint64 generation)
+{
+    QFileInfo m3u(m3uPath);
+    return QString("%1%2 %3 %4").arg(JOURNAL_TAG).arg(generation).arg(m3u.size())
+            .arg(m3u.lastModified().toMSecsSinceEpoch());
+}
+
+bool storage::replayJournal(const QString &filePath, const QString &m3uPath,
+                            qint64 generation, QStringList &entries)
+{
+    TRACE_SCOPE("storage::replayJournal", filePath);
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    QTextStream qts(&file);
+    qts.setCodec("UTF-8");
+    QStringList records = qts.readAll().split('\n');
+    // A record only counts once its newline made it to the disk.  Whatever
+    // follows the last one is a write that was interrupted.
+    records.removeLast();
+    if (records.isEmpty())
+        return false;
+    // Journals from before the m3u's size and time were noted only have the
+    // generation to go on.
+    const QString &header = records.first();
+    if (header != journalHeader(m3uPath, generation)
+            && header != JOURNAL_TAG + QString::number(generation))
+        return false;
+
+    bool ok1, ok2;
+    for (int i = 1; i < records.count(); i++) {
+        const QString &s = records.at(i);
+        if (s.isEmpty())
+            continue;
+        QString arg = s.mid(1);
+        if (s[0] == '+') {
+            entries.append(arg);
+        } else if (s[0] == '-') {
+            int index = arg.toInt(&ok1);
+            if (!ok1 || index < 0 || index >= entries.count())
+                break;
+            entries.removeAt(index);
+        } else if (s[0] == '>') {
+            int from = arg.section(' ', 0, 0).toInt(&ok1);
+            int to = arg.section(' ', 1, 1).toInt(&ok2);
+            if (!ok1 || !ok2 || from < 0 || to < 0
+                    || from >= entries.count() || to >= entries.count())
+                break;
+            entries.move(from, to);
+        }
+    }
+    return true;
+}
+
+void storage::enumeration_resultReadyAt(int index)
+{
+    loadedPlaylist loaded = enumeration->resultAt(index);
+    if (!loaded.ok) {
+        emit playlistUnreadable(loaded.title);
+        return;
+    }
+    known.insert(loaded.title, loaded.stamp);
+    snapshotEntry &entry = snapshot.playlists[loaded.title];
+    entry.stamp = loaded.stamp;
+    entry.generation = loaded.generation;
+    entry.entries = loaded.entries;
+    emit playlistFound(loaded.title, loaded.entries.count());
+}
+
+void storage::snapshotReader_finished()
+{
+    TRACE_SCOPE("storage::snapshotReader_finished");
+    snapshot = snapshotReader->result();
+    snapshotReader->setFuture(QFuture<snapshotData>());
+
+    // We start with two lists: whats on the disk and the tab order from last
+    // time.  So we merge the two, and load whatever playlists we can find.
+    // Saved tabs whose playlist has gone missing are quietly skipped.  If
+    // the tab file went astray, the snapshot remembers the order too.
+    QStringList savedLists = readTabs();
+    if (savedLists.isEmpty())
+        savedLists = snapshot.tabs;
+    QStringList allLists = orderedPlaylists(savedLists);
+
+    // Announce everything up front so the tabs appear in the right order,
+    // then load the playlists on the thread pool.  They come back in
+    // whatever order they finish in.
+    QStringList titles;
+    foreach (const QString &s, allLists) {
+        titles.append(QFileInfo(s).completeBaseName());
+        emit playlistPending(titles.last());
+    }
+    enumeration = new QFutureWatcher<loadedPlaylist>(this);
+    connect(enumeration, SIGNAL(resultReadyAt(int)), SLOT(enumeration_resultReadyAt(int)));
+    connect(enumeration, SIGNAL(finished()), SLOT(enumeration_finished()));
+    enumeration->setFuture(QtConcurrent::mapped(titles, playlistLoader(this, snapshot, false)));
+}
+
+void storage::enumeration_finished()
+{
+    TRACE_SCOPE("storage::enumeration_finished");
+    // Refresh the snapshot if anything had to be parsed, so next time it
+    // won't have to be.
+    snapshotData fresh;
+    bool stale = false;
+    foreach (const loadedPlaylist &loaded, enumeration->future().results()) {
+        if (!loaded.ok)
+            continue;
+        fresh.tabs.append(loaded.title);
+        snapshotEntry &entry = fresh.playlists[loaded.title];
+        entry.stamp = loaded.stamp;
+        entry.generation = loaded.generation;
+        entry.entries = loaded.entries;
+        stale = stale || !loaded.cached;
+    }
+    if (stale)
+        snapshotWriter = QtConcurrent::run(&storage::writeSnapshot, snapshotPath(), fresh);
+
+    // Most tabs only keep a count of their entries, so the snapshot keeps
+    // the one copy of what they hold, not this as well.  Playlists that were
+    // in the file but aren't on the disk any more go from it too.
+    QHash<QString, snapshotEntry>::iterator i = snapshot.playlists.begin();
+    while (i != snapshot.playlists.end()) {
+        if (known.contains(i.key()))
+            ++i;
+        else
+            i = snapshot.playlists.erase(i);
+    }
+    enumeration->setFuture(QFuture<loadedPlaylist>());
+
+    // Only now do we know what the playlists looked like, so only now can
+    // we start watching for changes to them.
+    dirWatcher->addPath(configPath);
+    rescan();
+    emit finishedEnumerating();
+    if (!requestQueue.isEmpty() && !requestsWaiting())
+        startRequests();
+}
+
@@ -3,6 +3,14 @@
 
 #include <QObject>
 #include <QStringList>
+#include <QHash>
+#include <QFutureWatcher>
+#include <QThread>
+#include <QTimer>
+#include <QFileSystemWatcher>
+
+class writer;
+class QLockFile;
 
 /* Note that our implementation of a storage backend does not try to keep a
  * in-memory copy of our playlists and sync with something like a save
@@ -17,6 +25,27 @@
  * directory.  The title of each playlist in the gui is the name of each file.
  * We do store the tab order in an text file and attempt to restore it,
  * however.
+ *
+ * To save parsing every playlist on every launch, we also keep a binary
+ * snapshot of the playlists beside them.  It is only ever a cache: each entry
+ * is stamped with the size and modification time of its files, and anything
+ * that does not match is parsed from the m3u as usual.
+ *
+ * Playlists may also be edited behind our back while we are running.  We
+ * watch the config directory, and whenever a playlist's files no longer
+ * match what we last read or wrote, it is loaded again and passed along as
+ * changed, new, or vanished.
+ *
+ * Rewriting a whole playlist because one entry moved gets silly with large
+ * queues, so small edits are appended to a journal file next to the playlist
+ * instead (see the comment above appendEntries).  The journal is folded back
+ * into the m3u once it grows large enough, and replayed when we start up.
+ *
+ * The gui and mplaylist-cli may both be at the same playlist, so anything
+ * that writes its files takes the playlist's lock file first (see
+ * lockPlaylist).  That keeps the files whole; it does not keep the two in
+ * step.  The gui only finds out what the cli did when its directory watcher
+ * next notices.
  */
 
 class storage : public QObject
@@ -24,6 +53,7 @@ class storage : public QObject
     Q_OBJECT
 public:
     explicit storage(QObject *parent = 0);
+    ~storage();
 
     /* This is an absurd amount of error detection.  We could display error
      * dialogs from this class, but those belong in the ui/view classes.
@@ -36,12 +66,64 @@ public:
     storeReturns renamePlaylist(const QString &oldTitle, const QString &newTitle);
     storeReturns removePlaylist(const QString &title);
     // Note the use of the non-const parameter.  Instead of passing this back
-    // on the stack, we modify what was passed to us.
+    // on the stack, we modify what was passed to us.  The entries are not
+    // checked for missing files here, as that may take a while; load the
+    // playlist with requestPlaylist for that.
     storeReturns importPlaylist(const QString &filePath, const QString &title, QStringList &entries);
     storeReturns exportPlaylist(const QString &filePath, const QStringList &entries);
     storeReturns updatePlaylist(const QString &title, const QStringList &entries);
+
+    /* Journaled edits.  Each call appends a single record to the playlist's
+     * journal, so the cost does not depend upon the length of the playlist.
+     * Nobody has to hand us the whole playlist for it either: when the
+     * journal is due to be compacted, the writer reads the m3u back and
+     * replays the journal over it, so that cost is only paid once per so
+     * many edits.
+     *
+     * Every m3u we write carries a generation number in a comment, and every
+     * journal names the generation it applies to.  Compacting writes the m3u
+     * for the next generation, then removes the journal.  Should we crash in
+     * between, the journal no longer matches and is not replayed.  The
+     * journal also notes the size and modification time of the m3u it was
+     * started against, since an outside edit may well keep our generation
+     * comment; its records are by index, and would remove or move the wrong
+     * entries of somebody else's list.
+     *
+     * All of this, and updatePlaylist, happens on the writer thread (see
+     * writer.h), so these return before anything has reached the disk.
+     * Failures turn up later through writeFailed, once for each run of them;
+     * the writer keeps trying in the meantime.
+     */
+    storeReturns appendEntries(const QString &title, const QStringList &added);
+    storeReturns removeEntry(const QString &title, int index);
+    // indexes are sorted, and numbered as they were before the removal.
+    storeReturns removeEntries(const QString &title, const QList<int> &indexes);
+    storeReturns moveEntry(const QString &title, int from, int to);
     void enumPlaylists();
     void saveTabs(const QStringList &tabs);
+    // Called on the way out with everything the tabs hold, in tab order.
+    // Tabs that were never loaded, or were put away again, have no queue to
+    // give; they are named in unloaded and keep what the last snapshot had,
+    // so long as their files have not changed since.
+    void saveSnapshot(const QStringList &titles, const QList<QStringList> &queues,
+                      const QStringList &unloaded = QStringList());
+    // Loads a single playlist on the thread pool, for a tab that is being
+    // shown.  What enumeration read is used if the files haven't changed
+    // since, and only now are the entries checked for missing files.  The
+    // result turns up as playlistLoaded.
+    void requestPlaylist(const QString &title);
+
+    // The same again, but there and then, for when there is no event loop
+    // to wait in (see cli.h).
+    QStringList listPlaylists();
+    storeReturns readPlaylist(const QString &title, QStringList &entries);
+    // The same again, for a look only: any journal is replayed in memory
+    // and left where it is, so nothing on the disk changes.
+    storeReturns peekPlaylist(const QString &title, QStringList &entries);
+    // Everything handed to the writer so far is on the disk when this
+    // returns.  Failures still turn up as writeFailed, once the event loop
+    // gets to them.
+    void flush();
 
 private:
     /* Literally the only reason why this is a class and not a bunch of static
@@ -58,27 +140,142 @@ private:
     QString configPath;
     void fetchConfigPath();
 
-    QStringList entriesFromPlaylist(const QString &filePath);
-    QStringList entriesToM3U(const QStringList &entries);
-    QStringList entriesFromM3U(QStringList);
-    QString playlistToPath(const QString &title);
+    // What a playlist's files looked like when it was snapshotted.  A size
+    // of -1 means the file was not there.
+    struct playlistStamp {
+        qint64 m3uSize, m3uModified;
+        qint64 journalSize, journalModified;
+        bool operator==(const playlistStamp &other) const;
+    };
+    struct snapshotEntry {
+        playlistStamp stamp;
+        qint64 generation;
+        QStringList entries;
+    };
+    struct snapshotData {
+        QStringList tabs;
+        QHash<QString, snapshotEntry> playlists;
+    };
+
+    // Playlists are parsed on the thread pool when enumerating.  The loader
+    // only reads configPath, which never changes after construction, and its
+    // own copy of the snapshot.  Enumeration leaves out looking for missing
+    // files, as most tabs only want a count.
+    struct loadedPlaylist {
+        QString title;
+        QStringList entries;
+        QStringList missing;
+        qint64 generation;
+        playlistStamp stamp;
+        bool ok;
+        bool cached;
+    };
+    struct playlistLoader {
+        typedef loadedPlaylist result_type;
+        playlistLoader(const storage *store, const snapshotData &snapshot, bool validate)
+            : store(store), snapshot(snapshot), validate(validate) {}
+        loadedPlaylist operator()(const QString &title);
+        const storage *store;
+        snapshotData snapshot;
+        bool validate;
+    };
+    QFutureWatcher<snapshotData> *snapshotReader;
+    QFutureWatcher<loadedPlaylist> *enumeration;
+    QFuture<void> snapshotWriter;
+
+    // What each playlist's files looked like when we last read or wrote
+    // them, and the machinery for noticing when somebody else does.
+    QHash<QString, playlistStamp> known;
+    QFileSystemWatcher *dirWatcher;
+    QTimer *rescanTimer;
+    QFutureWatcher<loadedPlaylist> *reloads;
+    QStringList reloadQueue;
+    // Playlists asked for by requestPlaylist.  Like reloads, these wait for
+    // any other loading to finish, as loading may compact the files.
+    QFutureWatcher<loadedPlaylist> *requests;
+    QStringList requestQueue;
+    bool loading();
+    bool requestsWaiting();
+    void startRequests();
+    // What enumeration read, so the first requestPlaylist for each playlist
+    // doesn't parse it again.  A playlist is let go of once it has been
+    // handed over, as the tab has its own copy, and any edit would leave
+    // this one stale anyway.
+    snapshotData snapshot;
+
+    // The writer lives on its own thread, and borrows our path functions
+    // and file helpers below.
+    friend class writer;
+    QThread writerThread;
+    writer *playlistWriter;
+
+    static QStringList entriesToM3U(const QStringList &entries, qint64 generation = -1);
+    static bool entriesFromM3U(const QString &filePath, QStringList &entries, qint64 &generation);
+    QString playlistToPath(const QString &title) const;
+    QString journalToPath(const QString &title) const;
+    QString lockToPath(const QString &title) const;
+    static bool lockPlaylist(QLockFile &lock);
     bool entriesFromPlaylist(const QString &filePath, QStringList &entries);
-    storeReturns writeEntriesToFile(const QString &filePath, const QStringList &entries);
     bool playlistAlreadyExists(const QString &title);
 
+    bool loadPlaylist(const QString &title, QStringList &entries, qint64 &generation,
+                      bool fold = true) const;
+    playlistStamp stampPlaylist(const QString &title) const;
+    QString snapshotPath() const;
+    static snapshotData readSnapshot(const QString &filePath);
+    static void writeSnapshot(const QString &filePath, const snapshotData &snapshot);
+    storeReturns writeJournal(const QString &title, const QString &records);
+    static storeReturns commitEntriesToFile(const QString &filePath, const QStringList &entries, qint64 generation);
+    static qint64 appendToJournal(const QString &filePath, const QString &m3uPath, qint64 generation,
+                                  qint64 sizeBefore, const QString &records);
+    static qint64 generationOfM3U(const QString &filePath);
+    static QString journalHeader(const QString &m3uPath, qint64 generation);
+    static bool replayJournal(const QString &filePath, const QString &m3uPath,
+                              qint64 generation, QStringList &entries);
+
     /* Because QSettings sorts string lists upon read, we need our own storage
      * functions for this.
      */
     QStringList readTabs();
     void writeTabs(const QStringList &tabs);
+    // The m3u files in the config directory, in the order given and then
+    // whatever else is there.
+    QStringList orderedPlaylists(const QStringList &savedLists);
 
 
 signals:
-    void playlistFound(const QString &name, const QStringList& entries);
+    // Enumeration is asynchronous.  Every playlist is announced as pending in
+    // tab order first, then found (or not) in whatever order it is parsed.
+    // Only the count is given; the entries are for requestPlaylist.
+    // Elsewhere, entries whose files could not be found are passed along as
+    // missing, rather than dropped, in case their share comes back later.
+    void playlistPending(const QString &name);
+    void playlistFound(const QString &name, int count);
+    void playlistUnreadable(const QString &name);
     void finishedEnumerating();
+    // Edits made to the playlist files by someone other than us.
+    void playlistChanged(const QString &name, const QStringList &entries, const QStringList &missing);
+    void playlistVanished(const QString &name);
+    // The answer to requestPlaylist.  If it can no longer be read, that is
+    // reported as playlistUnreadable instead.
+    void playlistLoaded(const QString &name, const QStringList &entries, const QStringList &missing);
+    void writeFailed(const QString &name, storage::storeReturns why);
 
 public slots:
 
+private slots:
+    void snapshotReader_finished();
+    void enumeration_resultReadyAt(int index);
+    void enumeration_finished();
+    void writer_writeFailed(const QString &title, int why);
+    void writer_playlistWritten(const QString &title);
+    void dirWatcher_changed();
+    void rescan();
+    void reloads_resultReadyAt(int index);
+    void reloads_finished();
+    void requests_resultReadyAt(int index);
+    void requests_finished();
+
 };
 
 #endif // STORAGE_H
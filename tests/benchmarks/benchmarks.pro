@@ -0,0 +1,15 @@
+#-------------------------------------------------
+#
+# Benchmarks.  These are built along with the tests, but make check leaves
+# them alone, as some take minutes and some need mpv and media of your own.
+# Run each by hand; each says at the top of its tst_*.cpp what it wants.
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    playlistparse \
+    probethroughput \
+    queuememory \
+    startlatency
@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Reading big playlists, mapped against the way it used to be done.  See
+# tst_playlistparse.cpp.
+#
+#-------------------------------------------------
+
+QT       += core concurrent testlib
+QT       -= gui
+
+TARGET = tst_playlistparse
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../../..
+DEPENDPATH += ../../..
+
+SOURCES += tst_playlistparse.cpp \
+    ../../../storage.cpp \
+    ../../../writer.cpp \
+    ../../../validator.cpp \
+    ../../../tracer.cpp
+
+HEADERS  += ../../../storage.h \
+    ../../../writer.h \
+    ../../../validator.h \
+    ../../../tracer.h
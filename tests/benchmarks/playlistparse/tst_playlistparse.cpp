@@ -0,0 +1,117 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include "storage.h"
+
+/* How long it takes to read a playlist of so many lines, through storage as
+ * the program does it, and the way it was done before playlists were mapped:
+ * the whole file read into one string, split into lines, and every line
+ * trimmed into a copy of its own.  The playlists are written by storage, into
+ * a config directory of our own, so nothing of yours is touched.
+ *
+ * Run it with -minimumvalue or -iterations to taste; the million-line rows
+ * take a while each.  Whatever is written is on a warm page cache by the time
+ * it is read, so this is the parsing, not the disk.
+ */
+
+class tst_playlistparse : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void parse_data();
+    void parse();
+    void cleanupTestCase();
+
+private:
+    QTemporaryDir dir;
+    storage *store;
+};
+
+// Paths the shape of a big archive: not many artists, a few albums each, and
+// some of the names not in ASCII, so the decoding has something to do.
+static QStringList samplePlaylist(int lines)
+{
+    QStringList entries;
+    entries.reserve(lines);
+    for (int i = 0; i < lines; i++)
+        entries.append(QString::fromUtf8("/srv/archive/Artist %1/Álbum %2/%3 - Track título %3.flac")
+                       .arg(i / 1000).arg(i / 100 % 10).arg(i % 100, 2, 10, QChar('0')));
+    return entries;
+}
+
+static QString titleFor(int lines)
+{
+    return QString("lines-%1").arg(lines);
+}
+
+// The reader as it was.
+static QStringList readAsBefore(const QString &filePath)
+{
+    QStringList items;
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return items;
+    QTextStream qts(&file);
+    qts.setCodec("UTF-8");
+    foreach (QString s, qts.readAll().split('\n')) {
+        s = s.trimmed();
+        if (s.isEmpty() || s[0] == '#')
+            continue;
+        items.append(s);
+    }
+    return items;
+}
+
+void tst_playlistparse::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    QCoreApplication::setOrganizationName("mplaylist-bench");
+    QCoreApplication::setApplicationName("playlistparse");
+    QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, dir.path());
+    store = new storage;
+    foreach (int lines, QList<int>() << 10000 << 100000 << 1000000)
+        QCOMPARE(int(store->addPlaylist(titleFor(lines), samplePlaylist(lines))),
+                 int(storage::srSuccess));
+}
+
+void tst_playlistparse::parse_data()
+{
+    QTest::addColumn<int>("lines");
+    QTest::addColumn<bool>("mapped");
+
+    foreach (int lines, QList<int>() << 10000 << 100000 << 1000000) {
+        QTest::newRow(qPrintable(QString("%1 lines, mapped").arg(lines))) << lines << true;
+        QTest::newRow(qPrintable(QString("%1 lines, as before").arg(lines))) << lines << false;
+    }
+}
+
+void tst_playlistparse::parse()
+{
+    QFETCH(int, lines);
+    QFETCH(bool, mapped);
+
+    // storage fixed the config directory when it was made.
+    QString path = QFileInfo(QSettings().fileName()).absolutePath() + "/" + titleFor(lines) + ".m3u";
+    QStringList entries;
+    if (mapped) {
+        QBENCHMARK {
+            QCOMPARE(int(store->peekPlaylist(titleFor(lines), entries)), int(storage::srSuccess));
+        }
+    } else {
+        QBENCHMARK {
+            entries = readAsBefore(path);
+        }
+    }
+    QCOMPARE(entries, samplePlaylist(lines));
+}
+
+void tst_playlistparse::cleanupTestCase()
+{
+    delete store;
+}
+
+QTEST_GUILESS_MAIN(tst_playlistparse)
+
+#include "tst_playlistparse.moc"
@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Probing files in batches, against one mpv per file.  See
+# tst_probethroughput.cpp.
+#
+#-------------------------------------------------
+
+QT       += core concurrent testlib
+QT       -= gui
+
+TARGET = tst_probethroughput
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../../..
+DEPENDPATH += ../../..
+
+SOURCES += tst_probethroughput.cpp \
+    ../../../prober.cpp \
+    ../../../probecache.cpp \
+    ../../../sniffer.cpp \
+    ../../../tracer.cpp
+
+HEADERS  += ../../../prober.h \
+    ../../../probecache.h \
+    ../../../sniffer.h \
+    ../../../tracer.h
@@ -0,0 +1,121 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QProcess>
+#include "prober.h"
+
+/* How long it takes to decide on so many files, through the prober as the
+ * program does it, and one mpv per file, waited on in turn, as it was done
+ * before batching.  The files are made up for each row, so none of them is
+ * in the probe cache, and they are the sort the sniffer can't place, so all
+ * of them go to mpv.  mpv doesn't recognize them either, which makes this
+ * mostly a measure of what starting mpv costs, and that is what batching
+ * saves.  Both ways must come to the same verdicts.
+ *
+ * It needs mpv on the PATH.  The probe cache is kept in the test location
+ * (see QStandardPaths::setTestModeEnabled), not yours.  The ten thousand
+ * files one at a time take minutes; pick rows on the command line to leave
+ * it out.
+ */
+
+// How long any one row may take, per file, on top of a minute.
+static const int FILE_TIMEOUT = 1000;
+
+class tst_probethroughput : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void probe_data();
+    void probe();
+
+private:
+    QTemporaryDir dir;
+    QHash<int, QStringList> acceptedBefore;
+};
+
+// Files made up to look like nothing the sniffer knows: a RIFF of no kind
+// it has heard of.  Each one is different, in case anybody is clever.
+static QStringList makeFiles(const QString &path, int count)
+{
+    QStringList files;
+    QDir().mkpath(path);
+    for (int i = 0; i < count; i++) {
+        QString fileName = QDir(path).filePath(QString("%1.bin").arg(i, 5, 10, QChar('0')));
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly))
+            return QStringList();
+        file.write(QByteArray("RIFF\x24\x00\x00\x00XXXX", 12) + QByteArray::number(i).leftJustified(32, ' '));
+        files.append(fileName);
+    }
+    return files;
+}
+
+static QStringList namesOf(const QStringList &files)
+{
+    QStringList names;
+    foreach (const QString &file, files)
+        names.append(QFileInfo(file).fileName());
+    return names;
+}
+
+void tst_probethroughput::initTestCase()
+{
+    if (QStandardPaths::findExecutable("mpv").isEmpty())
+        QSKIP("There is no mpv on the PATH.");
+    QVERIFY(dir.isValid());
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void tst_probethroughput::probe_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("batched");
+
+    // One at a time first, for the batched rows to be checked against.
+    foreach (int count, QList<int>() << 100 << 1000 << 10000) {
+        QTest::newRow(qPrintable(QString("%1 files, one at a time").arg(count))) << count << false;
+        QTest::newRow(qPrintable(QString("%1 files, batched").arg(count))) << count << true;
+    }
+}
+
+void tst_probethroughput::probe()
+{
+    QFETCH(int, count);
+    QFETCH(bool, batched);
+
+    QStringList files = makeFiles(dir.filePath(QTest::currentDataTag()), count);
+    QCOMPARE(files.count(), count);
+    QStringList accepted;
+    if (batched) {
+        prober p;
+        QSignalSpy acceptedSpy(&p, SIGNAL(accepted(QStringList)));
+        QSignalSpy finishedSpy(&p, SIGNAL(finished()));
+        QBENCHMARK_ONCE {
+            p.probe(files);
+            QVERIFY(finishedSpy.wait(60000 + count * FILE_TIMEOUT));
+        }
+        foreach (const QList<QVariant> &arguments, acceptedSpy)
+            accepted.append(arguments.at(0).toStringList());
+    } else {
+        QBENCHMARK_ONCE {
+            foreach (const QString &file, files) {
+                QProcess process;
+                process.start("mpv", prober::probeArguments(file));
+                bool finished = process.waitForFinished();
+                if (prober::readProbe(finished, process.readAll()).playable)
+                    accepted.append(file);
+            }
+        }
+    }
+    qDebug() << count << "files," << accepted.count() << "accepted";
+
+    if (batched && acceptedBefore.contains(count))
+        QCOMPARE(namesOf(accepted), acceptedBefore.value(count));
+    else if (!batched)
+        acceptedBefore.insert(count, namesOf(accepted));
+}
+
+QTEST_GUILESS_MAIN(tst_probethroughput)
+
+#include "tst_probethroughput.moc"
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# What a big queue costs in memory, as handles and as strings.  See
+# tst_queuememory.cpp.
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_queuememory
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../../..
+DEPENDPATH += ../../..
+
+SOURCES += tst_queuememory.cpp \
+    ../../../indexedqueue.cpp \
+    ../../../patharena.cpp
+
+HEADERS  += ../../../indexedqueue.h \
+    ../../../patharena.h
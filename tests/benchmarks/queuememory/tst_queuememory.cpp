@@ -0,0 +1,115 @@
+#include <QtTest>
+#include "indexedqueue.h"
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+/* How much memory a queue of half a million entries holds on to, kept as
+ * full paths in a QStringList, the way queues used to be, and kept as handles
+ * into the path arena.  The paths are the shape of a big archive: a long
+ * prefix in common, a few thousand directories and the odd name that isn't
+ * ASCII.
+ *
+ * What counts is the heap in use, as glibc's allocator sees it, from before
+ * the paths are made until the queue is all that is left of them, so memory
+ * that was freed but not handed back to the system is left out.  The
+ * resident set size is printed as well, for comparison with what top says.
+ * The arena is shared and never shrinks, so the arena row has to run in a
+ * process of its own, or after the strings.  Only runs with glibc.
+ */
+
+static const int ENTRIES = 500000;
+
+class tst_queuememory : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void strings();
+    void arena();
+};
+
+static QString samplePath(int i)
+{
+    return QString::fromUtf8("/srv/media/archive/music/Artist %1/Álbum %2/%3 - Track título %3.flac")
+            .arg(i / 200).arg(i / 20 % 10).arg(i % 20, 2, 10, QChar('0'));
+}
+
+static QStringList samplePaths()
+{
+    QStringList paths;
+    paths.reserve(ENTRIES);
+    for (int i = 0; i < ENTRIES; i++)
+        paths.append(samplePath(i));
+    return paths;
+}
+
+static qint64 heapInUse()
+{
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+    return qint64(mallinfo2().uordblks);
+#else
+    return qint64(mallinfo().uordblks);
+#endif
+#else
+    return -1;
+#endif
+}
+
+static qint64 residentSize()
+{
+#ifdef Q_OS_LINUX
+    QFile statm("/proc/self/statm");
+    if (statm.open(QIODevice::ReadOnly))
+        return statm.readAll().split(' ').value(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#endif
+    return -1;
+}
+
+static void report(const char *what, qint64 heapBefore, qint64 residentBefore)
+{
+    qint64 heap = heapInUse() - heapBefore;
+    qDebug() << what << ENTRIES << "entries:" << heap / 1024 << "KiB of heap,"
+             << heap / ENTRIES << "bytes each; resident set grew by"
+             << (residentSize() - residentBefore) / 1024 << "KiB";
+    QTest::setBenchmarkResult(heap, QTest::BytesAllocated);
+}
+
+void tst_queuememory::initTestCase()
+{
+#ifndef __GLIBC__
+    QSKIP("The heap can only be measured with glibc.");
+#endif
+}
+
+void tst_queuememory::strings()
+{
+    qint64 heapBefore = heapInUse();
+    qint64 residentBefore = residentSize();
+    QStringList queue = samplePaths();
+    report("as strings,", heapBefore, residentBefore);
+    QCOMPARE(queue.count(), ENTRIES);
+}
+
+void tst_queuememory::arena()
+{
+    qint64 heapBefore = heapInUse();
+    qint64 residentBefore = residentSize();
+    indexedqueue queue;
+    {
+        QStringList paths = samplePaths();
+        queue.setList(paths);
+    }
+    report("as handles,", heapBefore, residentBefore);
+    QCOMPARE(queue.count(), ENTRIES);
+    QCOMPARE(queue.at(ENTRIES - 1), samplePath(ENTRIES - 1));
+}
+
+QTEST_APPLESS_MAIN(tst_queuememory)
+
+#include "tst_queuememory.moc"
@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# The gap between files, with and without read ahead.  See
+# tst_startlatency.cpp.
+#
+#-------------------------------------------------
+
+QT       += core concurrent network testlib
+QT       -= gui
+
+TARGET = tst_startlatency
+CONFIG   += console
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../../..
+DEPENDPATH += ../../..
+
+SOURCES += tst_startlatency.cpp \
+    ../../../player.cpp \
+    ../../../latencystats.cpp \
+    ../../../tracer.cpp
+
+HEADERS  += ../../../player.h \
+    ../../../latencystats.h \
+    ../../../tracer.h
@@ -0,0 +1,163 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include "player.h"
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
+/* How long the gap is from the end of one file to the first frame of the
+ * next, with and without the next one read ahead, for both kinds of player.
+ * This plays real files through a real mpv, so it needs some of your own:
+ * point MPLAYLIST_BENCH_MEDIA at a directory of them, preferably on the sort
+ * of disk or share where the gap is a problem.  mpv gets a config directory
+ * of our own, which plays a second of each file with nothing for output.
+ * Every file is dropped from the page cache before each run, so each one
+ * starts cold unless it was read ahead.
+ *
+ * The median gap of each run is its benchmark result, and the 95th
+ * percentile is printed alongside it.  Dropping files from the cache takes
+ * posix_fadvise, so this only runs on Linux.
+ */
+
+// Files played per run.  The first has no gap before it.
+static const int MAX_FILES = 41;
+// How long each file gets, on top of the second it plays for.
+static const int FILE_TIMEOUT = 30000;
+
+// Plays the files one after the other, the way a tab does.
+class chain : public QObject
+{
+    Q_OBJECT
+public:
+    chain(player *p, const QStringList &files) : p(p), files(files), position(0)
+    {
+        connect(p, SIGNAL(playbackFinished(QString)), SLOT(player_done()));
+        connect(p, SIGNAL(playbackBadFile(QString)), SLOT(player_done()));
+        connect(p, SIGNAL(playbackNonstart(QString)), SLOT(player_done()));
+        connect(p, SIGNAL(playbackHalted(QString)), SLOT(player_done()));
+        connect(p, SIGNAL(playbackQuit(QString)), SLOT(player_done()));
+    }
+
+    void start()
+    {
+        p->playFile(files.first());
+        p->setNextFile(files.value(1));
+    }
+
+signals:
+    void finished();
+
+private slots:
+    void player_done()
+    {
+        if (++position >= files.count()) {
+            emit finished();
+            return;
+        }
+        p->playFile(files.at(position));
+        p->setNextFile(files.value(position + 1));
+    }
+
+private:
+    player *p;
+    QStringList files;
+    int position;
+};
+
+class tst_startlatency : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void gap_data();
+    void gap();
+
+private:
+    QTemporaryDir settingsDir;
+    QTemporaryDir mpvDir;
+    QStringList files;
+};
+
+static void dropFromCache(const QString &fileName)
+{
+#ifdef Q_OS_LINUX
+    QFile file(fileName);
+    if (file.open(QIODevice::ReadOnly))
+        posix_fadvise(file.handle(), 0, 0, POSIX_FADV_DONTNEED);
+#else
+    Q_UNUSED(fileName);
+#endif
+}
+
+void tst_startlatency::initTestCase()
+{
+#ifndef Q_OS_LINUX
+    QSKIP("Files can only be dropped from the page cache on Linux.");
+#endif
+    if (QStandardPaths::findExecutable("mpv").isEmpty())
+        QSKIP("There is no mpv on the PATH.");
+    QDir media(QString::fromLocal8Bit(qgetenv("MPLAYLIST_BENCH_MEDIA")));
+    if (qEnvironmentVariableIsEmpty("MPLAYLIST_BENCH_MEDIA") || !media.exists())
+        QSKIP("Set MPLAYLIST_BENCH_MEDIA to a directory of media files.");
+    foreach (const QString &name, media.entryList(QDir::Files, QDir::Name).mid(0, MAX_FILES))
+        files.append(media.filePath(name));
+    if (files.count() < 2)
+        QSKIP("MPLAYLIST_BENCH_MEDIA needs two files or more.");
+
+    QVERIFY(settingsDir.isValid());
+    QVERIFY(mpvDir.isValid());
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+    QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, settingsDir.path());
+    QFile conf(mpvDir.filePath("mpv.conf"));
+    QVERIFY(conf.open(QIODevice::WriteOnly));
+    conf.write("ao=null\nvo=null\nlength=1\n");
+    conf.close();
+    qputenv("MPV_HOME", QFile::encodeName(mpvDir.path()));
+}
+
+void tst_startlatency::gap_data()
+{
+    QTest::addColumn<bool>("persistent");
+    QTest::addColumn<bool>("readAhead");
+
+    QTest::newRow("process, cold") << false << false;
+    QTest::newRow("process, read ahead") << false << true;
+    QTest::newRow("persistent, cold") << true << false;
+    QTest::newRow("persistent, read ahead") << true << true;
+}
+
+void tst_startlatency::gap()
+{
+    QFETCH(bool, persistent);
+    QFETCH(bool, readAhead);
+
+    // The player only reads its settings when it is made.  Read ahead keeps
+    // to its default budget.
+    QSettings settings;
+    settings.setValue("player/persistent", persistent);
+    if (readAhead)
+        settings.remove("player/readaheadBytes");
+    else
+        settings.setValue("player/readaheadBytes", 0);
+    settings.sync();
+
+    foreach (const QString &file, files)
+        dropFromCache(file);
+    player p;
+    chain c(&p, files);
+    QSignalSpy finished(&c, SIGNAL(finished()));
+    c.start();
+    QVERIFY(finished.wait(files.count() * FILE_TIMEOUT));
+
+    int phase = readAhead ? player::lpGapReadAhead : player::lpGap;
+    if (!p.latencySamples(phase))
+        QSKIP("No file followed another; mpv may not have played any of them.");
+    qDebug() << player::phaseName(phase) << "p95" << p.latencyPercentile(phase, 95) / 1000.0
+             << "ms over" << p.latencySamples(phase) << "files";
+    QTest::setBenchmarkResult(p.latencyPercentile(phase, 50) / 1000.0, QTest::WalltimeMilliseconds);
+}
+
+QTEST_GUILESS_MAIN(tst_startlatency)
+
+#include "tst_startlatency.moc"
@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# The treap behind the queue, against a plain list.  See tst_indexedqueue.cpp.
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_indexedqueue
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_indexedqueue.cpp \
+    ../../indexedqueue.cpp \
+    ../../patharena.cpp
+
+HEADERS  += ../../indexedqueue.h \
+    ../../patharena.h
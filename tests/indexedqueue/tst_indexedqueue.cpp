@@ -0,0 +1,197 @@
+#include <QtTest>
+#include "indexedqueue.h"
+
+/* The treap is checked against a QStringList put through the same edits.
+ * The edits are random, from a fixed seed so that a failure comes back the
+ * same way every time, and drawn from a small pool of paths so that there
+ * are plenty of duplicates for indexesOf() to get wrong.
+ */
+
+class tst_indexedqueue : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void setList_data();
+    void setList();
+    void singleEdits();
+    void randomEdits();
+    void batchEdits();
+    void fileNames();
+
+private:
+    quint32 state;
+    int random(int bound);
+    QStringList pool(int count);
+    void verify(const indexedqueue &queue, const QStringList &list, const QStringList &paths);
+};
+
+int tst_indexedqueue::random(int bound)
+{
+    // xorshift32, which is all the randomness this needs.
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return bound > 0 ? int(state % quint32(bound)) : 0;
+}
+
+QStringList tst_indexedqueue::pool(int count)
+{
+    QStringList paths;
+    for (int i = 0; i < count; i++)
+        paths.append(QString("/music/album %1/%2 track.flac").arg(i % 7).arg(i));
+    return paths;
+}
+
+void tst_indexedqueue::verify(const indexedqueue &queue, const QStringList &list, const QStringList &paths)
+{
+    QCOMPARE(queue.count(), list.count());
+    QCOMPARE(queue.isEmpty(), list.isEmpty());
+    QCOMPARE(queue.toList(), list);
+    for (int i = 0; i < list.count(); i++)
+        QCOMPARE(queue.at(i), list.at(i));
+    foreach (const QString &path, paths) {
+        QList<int> expected;
+        for (int i = 0; i < list.count(); i++)
+            if (list.at(i) == path)
+                expected.append(i);
+        QCOMPARE(queue.indexesOf(path), expected);
+        QCOMPARE(queue.contains(path), !expected.isEmpty());
+    }
+}
+
+void tst_indexedqueue::setList_data()
+{
+    QTest::addColumn<QStringList>("list");
+    QTest::newRow("empty") << QStringList();
+    QTest::newRow("one") << (QStringList() << "/a");
+    QTest::newRow("duplicates") << (QStringList() << "/a" << "/b" << "/a" << "/a");
+    QTest::newRow("many") << pool(1000);
+}
+
+void tst_indexedqueue::setList()
+{
+    QFETCH(QStringList, list);
+    indexedqueue queue;
+    queue.setList(list);
+    verify(queue, list, list);
+    queue.clear();
+    verify(queue, QStringList(), list);
+}
+
+void tst_indexedqueue::singleEdits()
+{
+    QStringList paths = QStringList() << "/a" << "/b" << "/c" << "/d";
+    indexedqueue queue;
+    QStringList list;
+
+    queue.append("/a"); list.append("/a");
+    queue.append("/b"); list.append("/b");
+    queue.insert(0, "/c"); list.insert(0, "/c");
+    queue.insert(3, "/a"); list.insert(3, "/a");
+    verify(queue, list, paths);
+
+    queue.move(0, 3); list.move(0, 3);
+    verify(queue, list, paths);
+    queue.move(3, 0); list.move(3, 0);
+    verify(queue, list, paths);
+
+    queue.removeAt(1); list.removeAt(1);
+    verify(queue, list, paths);
+    queue.removeAt(list.count() - 1); list.removeLast();
+    verify(queue, list, paths);
+}
+
+void tst_indexedqueue::randomEdits()
+{
+    QStringList paths = pool(50);
+    indexedqueue queue;
+    QStringList list;
+    state = 2463534242u;
+
+    for (int step = 0; step < 20000; step++) {
+        int op = random(10);
+        if (list.isEmpty() || op < 3) {
+            QString path = paths.at(random(paths.count()));
+            int at = random(list.count() + 1);
+            queue.insert(at, path);
+            list.insert(at, path);
+        } else if (op < 4) {
+            QString path = paths.at(random(paths.count()));
+            queue.append(path);
+            list.append(path);
+        } else if (op < 7) {
+            int at = random(list.count());
+            queue.removeAt(at);
+            list.removeAt(at);
+        } else {
+            int from = random(list.count());
+            int to = random(list.count());
+            queue.move(from, to);
+            list.move(from, to);
+        }
+        if (step % 500 == 0)
+            verify(queue, list, paths);
+    }
+    verify(queue, list, paths);
+}
+
+void tst_indexedqueue::batchEdits()
+{
+    QStringList paths = pool(100);
+    indexedqueue queue;
+    QStringList list;
+    state = 88172645u;
+    for (int i = 0; i < 2000; i++)
+        list.append(paths.at(random(paths.count())));
+    queue.setList(list);
+
+    for (int round = 0; round < 50; round++) {
+        // Take out a sorted handful, numbered as they were before.
+        QList<int> doomed;
+        for (int i = 0; i < list.count(); i++)
+            if (random(20) == 0)
+                doomed.append(i);
+        queue.removeAll(doomed);
+        for (int i = doomed.count() - 1; i >= 0; i--)
+            list.removeAt(doomed.at(i));
+        verify(queue, list, paths);
+
+        // Shuffle, then put some back so it doesn't run dry.
+        QVector<int> from(list.count());
+        for (int i = 0; i < from.count(); i++)
+            from[i] = i;
+        for (int i = from.count() - 1; i > 0; i--)
+            std::swap(from[i], from[random(i + 1)]);
+        queue.permute(from);
+        QStringList shuffled;
+        foreach (int position, from)
+            shuffled.append(list.at(position));
+        list = shuffled;
+        verify(queue, list, paths);
+
+        for (int i = 0; i < 40; i++) {
+            QString path = paths.at(random(paths.count()));
+            queue.append(path);
+            list.append(path);
+        }
+    }
+}
+
+void tst_indexedqueue::fileNames()
+{
+    QStringList list = pool(20);
+    indexedqueue queue;
+    queue.setList(list);
+    QVector<patharena::handle> handles = queue.handles();
+    QCOMPARE(handles.count(), list.count());
+    for (int i = 0; i < list.count(); i++) {
+        QCOMPARE(queue.fileNameAt(i), list.at(i).section('/', -1));
+        QCOMPARE(queue.handleAt(i), handles.at(i));
+        QCOMPARE(patharena::instance()->path(handles.at(i)), list.at(i));
+    }
+}
+
+QTEST_APPLESS_MAIN(tst_indexedqueue)
+
+#include "tst_indexedqueue.moc"
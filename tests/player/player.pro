@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# The persistent player against a fake mpv.  See tst_player.cpp.
+#
+#-------------------------------------------------
+
+QT       += core concurrent network testlib
+QT       -= gui
+
+TARGET = tst_player
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_player.cpp \
+    ../../player.cpp \
+    ../../latencystats.cpp \
+    ../../tracer.cpp
+
+HEADERS  += ../../player.h \
+    ../../latencystats.h \
+    ../../tracer.h
@@ -0,0 +1,289 @@
+#include <QtTest>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include "player.h"
+
+/* The persistent player only ever talks to mpv through its socket, so we can
+ * stand in for mpv.  The player runs "mpv" off the PATH, and the PATH leads
+ * back to this very binary, which notices the --input-ipc-server argument
+ * and behaves like a (very forgetful) mpv: every command it gets is written
+ * to the file named by FAKE_MPV_LOG, requests are answered the way mpv 0.34
+ * answers them, and files whose names start with "eof:" end by themselves
+ * shortly after they start.
+ */
+
+static const int FAKE_EOF_DELAY = 100;
+
+class fakempv : public QObject
+{
+    Q_OBJECT
+public:
+    fakempv(const QString &name, const QString &logPath) :
+        client(NULL), lastEntry(0), current(0)
+    {
+        log.setFileName(logPath);
+        log.open(QIODevice::WriteOnly | QIODevice::Append);
+        QLocalServer::removeServer(name);
+        server.listen(name);
+        connect(&server, SIGNAL(newConnection()), SLOT(server_newConnection()));
+    }
+
+private slots:
+    void server_newConnection()
+    {
+        client = server.nextPendingConnection();
+        connect(client, SIGNAL(readyRead()), SLOT(client_readyRead()));
+    }
+
+    void client_readyRead()
+    {
+        while (client->canReadLine()) {
+            QByteArray line = client->readLine();
+            log.write(line);
+            log.flush();
+            QJsonObject request = QJsonDocument::fromJson(line).object();
+            command(request.value("command").toArray(), request.value("request_id").toInt(-1));
+        }
+    }
+
+    void endOfFile()
+    {
+        if (!current)
+            return;
+        event("end-file", current, "eof");
+        current = 0;
+        if (!queued.isEmpty())
+            start(queued.takeFirst());
+    }
+
+private:
+    QFile log;
+    QLocalServer server;
+    QLocalSocket *client;
+    int lastEntry;
+    int current;
+    QList<QPair<int, QString> > queued;
+
+    void command(const QJsonArray &args, int requestId)
+    {
+        // Like mpv, answer first, then get on with it.
+        QString name = args.at(0).toString();
+        if (name == "loadfile")
+            reply(requestId, ++lastEntry);
+        else
+            reply(requestId, -1);
+        if (name == "loadfile" && args.at(2).toString() == "replace") {
+            if (current)
+                event("end-file", current, "stop");
+            queued.clear();
+            start(qMakePair(lastEntry, args.at(1).toString()));
+        } else if (name == "loadfile") {
+            queued.append(qMakePair(lastEntry, args.at(1).toString()));
+        } else if (name == "playlist-clear") {
+            queued.clear();
+        } else if (name == "stop") {
+            if (current)
+                event("end-file", current, "stop");
+            current = 0;
+            queued.clear();
+        } else if (name == "quit") {
+            client->flush();
+            server.close();
+            qApp->quit();
+        }
+    }
+
+    void start(const QPair<int, QString> &file)
+    {
+        current = file.first;
+        event("start-file", current);
+        event("playback-restart", -1);
+        if (file.second.startsWith("eof:"))
+            QTimer::singleShot(FAKE_EOF_DELAY, this, SLOT(endOfFile()));
+    }
+
+    void reply(int requestId, int entry)
+    {
+        if (requestId < 0)
+            return;
+        QJsonObject object;
+        object.insert("request_id", requestId);
+        object.insert("error", QString("success"));
+        if (entry >= 0) {
+            QJsonObject data;
+            data.insert("playlist_entry_id", entry);
+            object.insert("data", data);
+        }
+        client->write(QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n');
+    }
+
+    void event(const QString &name, int entry, const QString &reason = QString())
+    {
+        QJsonObject object;
+        object.insert("event", name);
+        if (entry >= 0)
+            object.insert("playlist_entry_id", entry);
+        if (!reason.isEmpty())
+            object.insert("reason", reason);
+        client->write(QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n');
+    }
+};
+
+class tst_player : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanupTestCase();
+    void nextFileIsReplaced();
+    void rollsOverToNextFile();
+    void staleNextFileIsNotPlayed();
+    void rolloverDuringReplaceIsIgnored();
+    void quitsAndRemovesSocket();
+
+private:
+    QTemporaryDir bin;
+    QString logPath;
+    QStringList commands();
+    QStringList sockets();
+};
+
+void tst_player::initTestCase()
+{
+    QVERIFY(bin.isValid());
+    QVERIFY(QFile::link(QCoreApplication::applicationFilePath(), bin.filePath("mpv")));
+    qputenv("PATH", QFile::encodeName(bin.path()) + ':' + qgetenv("PATH"));
+    logPath = bin.filePath("commands.log");
+    qputenv("FAKE_MPV_LOG", QFile::encodeName(logPath));
+
+    QCoreApplication::setOrganizationName("mplaylist-tests");
+    QCoreApplication::setApplicationName("tst_player");
+    QSettings settings;
+    settings.setValue("player/persistent", true);
+    settings.setValue("player/readaheadBytes", 0);
+}
+
+void tst_player::init()
+{
+    QFile::remove(logPath);
+}
+
+void tst_player::cleanupTestCase()
+{
+    QSettings().clear();
+}
+
+QStringList tst_player::commands()
+{
+    QStringList list;
+    QFile file(logPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return list;
+    while (!file.atEnd()) {
+        QJsonArray args = QJsonDocument::fromJson(file.readLine()).object().value("command").toArray();
+        QStringList words;
+        foreach (const QJsonValue &arg, args)
+            words.append(arg.toString());
+        list.append(words.join(' '));
+    }
+    return list;
+}
+
+QStringList tst_player::sockets()
+{
+    QString pattern = QString("mplaylist-%1-*.sock").arg(QCoreApplication::applicationPid());
+    return QDir::temp().entryList(QStringList() << pattern, QDir::System | QDir::Files);
+}
+
+void tst_player::nextFileIsReplaced()
+{
+    player p;
+    p.playFile("a");
+    p.setNextFile("b");
+    p.setNextFile("c");
+    QTRY_COMPARE(commands(), QStringList()
+                 << "loadfile a replace"
+                 << "playlist-clear" << "loadfile b append"
+                 << "playlist-clear" << "loadfile c append");
+}
+
+void tst_player::rollsOverToNextFile()
+{
+    player p;
+    QSignalSpy finished(&p, SIGNAL(playbackFinished(QString)));
+    p.playFile("eof:a");
+    p.setNextFile("b");
+    QTRY_COMPARE(finished.count(), 1);
+    QCOMPARE(finished.at(0).at(0).toString(), QString("eof:a"));
+    QVERIFY(p.isPlaying());
+    // mpv is already playing b, so asking for it again mustn't restart it.
+    p.playFile("b");
+    QTest::qWait(FAKE_EOF_DELAY);
+    QVERIFY(!commands().contains("loadfile b replace"));
+}
+
+void tst_player::staleNextFileIsNotPlayed()
+{
+    player p;
+    QSignalSpy finished(&p, SIGNAL(playbackFinished(QString)));
+    p.playFile("eof:a");
+    p.setNextFile("b");
+    // b was removed from the queue before a finished.
+    p.setNextFile(QString());
+    QTRY_COMPARE(finished.count(), 1);
+    QVERIFY(!p.isPlaying());
+}
+
+void tst_player::rolloverDuringReplaceIsIgnored()
+{
+    player p;
+    QSignalSpy halted(&p, SIGNAL(playbackHalted(QString)));
+    p.playFile("eof:a");
+    p.setNextFile("b");
+    QTRY_VERIFY(commands().contains("loadfile b append"));
+    // a ends and mpv moves on to b, but we don't get to hear of it before
+    // asking for c.
+    QThread::msleep(FAKE_EOF_DELAY * 3);
+    p.playFile("c");
+    QTRY_VERIFY(commands().contains("loadfile c replace"));
+    QTest::qWait(FAKE_EOF_DELAY);
+    // b's start was not taken for c's, so b being stopped is not c halting.
+    QCOMPARE(halted.count(), 0);
+    QVERIFY(p.isPlaying());
+}
+
+void tst_player::quitsAndRemovesSocket()
+{
+    player *p = new player;
+    p->playFile("a");
+    QTRY_VERIFY(commands().contains("loadfile a replace"));
+    QVERIFY(!sockets().isEmpty());
+    delete p;
+    QVERIFY(commands().contains("quit"));
+    QVERIFY(sockets().isEmpty());
+}
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        QByteArray arg(argv[i]);
+        if (!arg.startsWith("--input-ipc-server="))
+            continue;
+        QCoreApplication app(argc, argv);
+        fakempv mpv(QFile::decodeName(arg.mid(arg.indexOf('=') + 1)),
+                    QFile::decodeName(qgetenv("FAKE_MPV_LOG")));
+        return app.exec();
+    }
+
+    QCoreApplication app(argc, argv);
+    tst_player test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_player.moc"
@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Splitting batched mpv probes by file.  See tst_prober.cpp.
+#
+#-------------------------------------------------
+
+QT       += core concurrent testlib
+QT       -= gui
+
+TARGET = tst_prober
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_prober.cpp \
+    ../../prober.cpp \
+    ../../probecache.cpp \
+    ../../sniffer.cpp \
+    ../../tracer.cpp
+
+HEADERS  += ../../prober.h \
+    ../../probecache.h \
+    ../../sniffer.h \
+    ../../tracer.h
@@ -0,0 +1,130 @@
+#include <QtTest>
+#include "prober.h"
+
+/* What mpv prints for a batch of files, cut down to the lines that matter,
+ * and what readBatch should make of it.  Verdicts are spelled out one letter
+ * per file: y for playable, n for not.  Files after the last verdict are the
+ * ones that have to be probed again.
+ */
+
+class tst_prober : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void readBatch_data();
+    void readBatch();
+    void readBatchStreams();
+    void batchArguments();
+};
+
+static QString verdicts(const QList<probecache::probe> &results)
+{
+    QString s;
+    foreach (const probecache::probe &result, results)
+        s.append(result.playable ? 'y' : 'n');
+    return s;
+}
+
+void tst_prober::readBatch_data()
+{
+    QTest::addColumn<QStringList>("files");
+    QTest::addColumn<bool>("finished");
+    QTest::addColumn<QString>("output");
+    QTest::addColumn<QString>("expected");
+
+    QStringList one = QStringList() << "/music/a.mp3";
+    QStringList three = QStringList() << "/music/a.mp3" << "/music/b.txt" << "/music/c.ogg";
+
+    QTest::newRow("single, played")
+            << one << true
+            << "Playing: /music/a.mp3\n (+) Audio --aid=1 (mp3 2ch 44100Hz)\n"
+            << "y";
+    QTest::newRow("single, unrecognized")
+            << one << true
+            << "Playing: /music/a.mp3\nFailed to recognize file format.\n"
+            << "n";
+    QTest::newRow("single, timed out")
+            << one << false
+            << "Playing: /music/a.mp3\n"
+            << "n";
+    QTest::newRow("batch, all done")
+            << three << true
+            << "Playing: /music/a.mp3\n (+) Audio --aid=1 (mp3 2ch 44100Hz)\n"
+               "Playing: /music/b.txt\nFailed to recognize file format.\n"
+               "Playing: /music/c.ogg\n (+) Audio --aid=1 (vorbis 2ch 48000Hz)\n"
+            << "yny";
+    QTest::newRow("batch, crashed in the last file")
+            << three << false
+            << "Playing: /music/a.mp3\n (+) Audio --aid=1 (mp3 2ch 44100Hz)\n"
+               "Playing: /music/b.txt\nFailed to recognize file format.\n"
+               "Playing: /music/c.ogg\n"
+            << "yn";
+    QTest::newRow("batch, crashed in the middle")
+            << three << false
+            << "Playing: /music/a.mp3\n (+) Audio --aid=1 (mp3 2ch 44100Hz)\n"
+               "Playing: /music/b.txt\n"
+            << "y";
+    QTest::newRow("batch, finished without getting to the last")
+            << three << true
+            << "Playing: /music/a.mp3\n (+) Audio --aid=1 (mp3 2ch 44100Hz)\n"
+               "Playing: /music/b.txt\nFailed to recognize file format.\n"
+            << "y";
+    QTest::newRow("batch, nothing announced")
+            << three << true
+            << "Error parsing option foo (option not found)\n"
+            << "";
+    QTest::newRow("batch, playlist expanded in place")
+            << (QStringList() << "/music/list.m3u" << "/music/c.ogg") << true
+            << "Playing: /music/list.m3u\n"
+               "Playing: /music/x.mp3\n (+) Audio --aid=1 (mp3 2ch 44100Hz)\n"
+               "Playing: /music/c.ogg\n (+) Audio --aid=1 (vorbis 2ch 48000Hz)\n"
+            << "yy";
+    QTest::newRow("batch, same file twice")
+            << (QStringList() << "/music/a.mp3" << "/music/a.mp3") << true
+            << "Playing: /music/a.mp3\n (+) Audio --aid=1 (mp3 2ch 44100Hz)\n"
+               "Playing: /music/a.mp3\n (+) Audio --aid=1 (mp3 2ch 44100Hz)\n"
+            << "yy";
+}
+
+void tst_prober::readBatch()
+{
+    QFETCH(QStringList, files);
+    QFETCH(bool, finished);
+    QFETCH(QString, output);
+    QFETCH(QString, expected);
+
+    QCOMPARE(verdicts(prober::readBatch(files, finished, output)), expected);
+}
+
+void tst_prober::readBatchStreams()
+{
+    // Each file's stream lines end up with that file, and no other.
+    QStringList files = QStringList() << "/music/a.mp3" << "/video/b.mkv";
+    QString output = "Playing: /music/a.mp3\n"
+                     " (+) Audio --aid=1 (mp3 2ch 44100Hz)\n"
+                     "Playing: /video/b.mkv\n"
+                     " (+) Video --vid=1 (h264 1920x1080 23.976fps)\n"
+                     " (+) Audio --aid=1 --alang=eng (aac 2ch 48000Hz)\n"
+                     "     Subs  --sid=1 --slang=eng (subrip)\n";
+    QList<probecache::probe> results = prober::readBatch(files, true, output);
+    QCOMPARE(results.count(), 2);
+    QCOMPARE(results.at(0).streams, QString("(+) Audio --aid=1 (mp3 2ch 44100Hz)\n"));
+    QCOMPARE(results.at(1).streams.count('\n'), 3);
+    QVERIFY(results.at(1).streams.contains("--vid=1"));
+    QVERIFY(!results.at(1).streams.contains("mp3"));
+}
+
+void tst_prober::batchArguments()
+{
+    // A batch is probed with the same options as a single file.
+    QStringList files = QStringList() << "/music/a.mp3" << "/music/b.ogg";
+    QStringList single = prober::probeArguments(files.first());
+    QStringList batch = prober::batchArguments(files);
+    QCOMPARE(batch.mid(0, single.count() - 1), single.mid(0, single.count() - 1));
+    QCOMPARE(batch.mid(single.count() - 1), files);
+}
+
+QTEST_APPLESS_MAIN(tst_prober)
+
+#include "tst_prober.moc"
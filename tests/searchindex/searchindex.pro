@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# The filter box's index, against looking at every name.  See
+# tst_searchindex.cpp.
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_searchindex
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_searchindex.cpp \
+    ../../searchindex.cpp \
+    ../../patharena.cpp
+
+HEADERS  += ../../searchindex.h \
+    ../../patharena.h
@@ -0,0 +1,134 @@
+#include <QtTest>
+#include "searchindex.h"
+
+/* The index is checked against the obvious way of searching: fold every
+ * name and see whether it has the query in it.  Names are made up from a
+ * small alphabet, with a capital or two, so that short queries match a lot
+ * of them and long ones a few.  Files come and go at random, often enough
+ * that the folded names get squeezed now and again.
+ */
+
+class tst_searchindex : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void find_data();
+    void find();
+    void randomEdits();
+
+private:
+    quint32 state;
+    int random(int bound);
+    QString randomText(int length);
+    static QList<patharena::handle> sorted(QList<patharena::handle> list);
+    static QList<patharena::handle> expected(const QHash<patharena::handle, int> &counts, const QString &text);
+};
+
+int tst_searchindex::random(int bound)
+{
+    // xorshift32, as in tst_indexedqueue.
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return bound > 0 ? int(state % quint32(bound)) : 0;
+}
+
+QString tst_searchindex::randomText(int length)
+{
+    static const char letters[] = "abcAB ";
+    QString text;
+    for (int i = 0; i < length; i++)
+        text.append(QChar(letters[random(sizeof(letters) - 1)]));
+    return text;
+}
+
+QList<patharena::handle> tst_searchindex::sorted(QList<patharena::handle> list)
+{
+    std::sort(list.begin(), list.end());
+    return list;
+}
+
+QList<patharena::handle> tst_searchindex::expected(const QHash<patharena::handle, int> &counts, const QString &text)
+{
+    QList<patharena::handle> matches;
+    QHash<patharena::handle, int>::const_iterator i;
+    for (i = counts.constBegin(); i != counts.constEnd(); ++i)
+        if (i.value() > 0 && searchindex::displayName(i.key()).toCaseFolded().contains(text.toCaseFolded()))
+            matches.append(i.key());
+    return sorted(matches);
+}
+
+static QStringList samplePaths()
+{
+    return QStringList()
+            << "/music/Abba/Waterloo.flac"
+            << "/music/Abba/SOS.flac"
+            << "/music/Various/A.mp3"
+            << "/music/Various/ab.ogg"
+            << "/music/Various/Straße.mp3";
+}
+
+void tst_searchindex::find_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QStringList>("expected");
+
+    QStringList paths = samplePaths();
+    QTest::newRow("one letter") << "a" << (QStringList() << paths.at(0) << paths.at(2) << paths.at(3) << paths.at(4));
+    QTest::newRow("two letters") << "OS" << (QStringList() << paths.at(1));
+    QTest::newRow("trigram") << "ter" << (QStringList() << paths.at(0));
+    QTest::newRow("longer") << "waterl" << (QStringList() << paths.at(0));
+    QTest::newRow("not there") << "xyz" << QStringList();
+    QTest::newRow("folded") << "STRASSE" << (QStringList() << paths.at(4));
+    QTest::newRow("not the directory") << "abba" << QStringList();
+    QTest::newRow("not the extension") << "flac" << QStringList();
+}
+
+void tst_searchindex::find()
+{
+    QFETCH(QString, text);
+    QFETCH(QStringList, expected);
+
+    QStringList paths = samplePaths();
+    searchindex index;
+    foreach (const QString &path, paths)
+        index.add(patharena::instance()->intern(path));
+    QList<patharena::handle> handles;
+    foreach (const QString &path, expected)
+        handles.append(patharena::instance()->intern(path));
+    QCOMPARE(sorted(index.find(text)), sorted(handles));
+}
+
+void tst_searchindex::randomEdits()
+{
+    state = 2463534242u;
+    QList<patharena::handle> pool;
+    for (int i = 0; i < 300; i++)
+        pool.append(patharena::instance()->intern(QString("/music/%1/%2.flac").arg(i % 9).arg(randomText(1 + i % 12))));
+    searchindex index;
+    QHash<patharena::handle, int> counts;
+
+    for (int step = 0; step < 5000; step++) {
+        patharena::handle file = pool.at(random(pool.count()));
+        if (random(3) > 0) {
+            index.add(file);
+            counts[file]++;
+        } else if (counts.value(file) > 0) {
+            index.remove(file);
+            counts[file]--;
+        }
+        if (step % 100 == 0) {
+            for (int length = 1; length <= 5; length++) {
+                QString text = randomText(length);
+                QCOMPARE(sorted(index.find(text)), expected(counts, text));
+            }
+        }
+    }
+    index.clear();
+    QCOMPARE(index.find("a"), QList<patharena::handle>());
+}
+
+QTEST_APPLESS_MAIN(tst_searchindex)
+
+#include "tst_searchindex.moc"
@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# Telling files apart by their first few bytes.  See tst_sniffer.cpp.
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_sniffer
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_sniffer.cpp \
+    ../../sniffer.cpp
+
+HEADERS  += ../../sniffer.h
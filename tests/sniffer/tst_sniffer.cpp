@@ -0,0 +1,100 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include "sniffer.h"
+
+/* The start of real files of each kind, as the sniffer would read them off
+ * the disk.  Only as much of each is given as it takes to tell them apart,
+ * and a little more, so the sniffer can't get by on the length alone.
+ */
+
+Q_DECLARE_METATYPE(sniffer::verdict)
+
+class tst_sniffer : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void sniff_data();
+    void sniff();
+    void missingFile();
+
+private:
+    QTemporaryDir dir;
+    int written;
+};
+
+// An ISO media file starts with its file type box: its size, "ftyp", the
+// major brand, a minor version, then the brands it is compatible with.
+static QByteArray ftyp(const QByteArray &major, const QByteArray &compatible)
+{
+    QByteArray box;
+    int size = 16 + compatible.size();
+    box.append(char(size >> 24)).append(char(size >> 16)).append(char(size >> 8)).append(char(size));
+    box.append("ftyp").append(major).append(QByteArray(4, '\0')).append(compatible);
+    // What usually follows, so there's something past the box.
+    box.append(QByteArray::fromHex("00000008667265650000000000000000"));
+    return box;
+}
+
+void tst_sniffer::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    written = 0;
+}
+
+void tst_sniffer::sniff_data()
+{
+    QTest::addColumn<QByteArray>("header");
+    QTest::addColumn<sniffer::verdict>("expected");
+
+    QTest::newRow("mp4") << ftyp("isom", "isomiso2avc1mp41") << sniffer::svPlayable;
+    QTest::newRow("m4a") << ftyp("M4A ", "M4A mp42isom") << sniffer::svPlayable;
+    QTest::newRow("mov") << ftyp("qt  ", "qt  ") << sniffer::svPlayable;
+    QTest::newRow("heic, from a phone") << ftyp("heic", "mif1heic") << sniffer::svUnplayable;
+    QTest::newRow("heif") << ftyp("mif1", "mif1heic") << sniffer::svUnplayable;
+    QTest::newRow("avif") << ftyp("avif", "avifmif1miafMA1B") << sniffer::svUnplayable;
+    QTest::newRow("heif sequence") << ftyp("msf1", "msf1hevc") << sniffer::svUnknown;
+    QTest::newRow("avif sequence") << ftyp("avis", "avismsf1miaf") << sniffer::svUnknown;
+
+    QTest::newRow("matroska") << QByteArray::fromHex("1a45dfa39f4286810142f7810142f2810442f381084282886d6174726f736b61")
+                              << sniffer::svPlayable;
+    QTest::newRow("ogg") << QByteArray::fromHex("4f67675300020000000000000000a3c5") << sniffer::svPlayable;
+    QTest::newRow("flac") << QByteArray::fromHex("664c614300000022100010000006e1") << sniffer::svPlayable;
+    QTest::newRow("mp3 with tags") << QByteArray::fromHex("494433040000000002015449543200") << sniffer::svPlayable;
+    QTest::newRow("wav") << QByteArray::fromHex("524946462408000057415645666d7420")
+                         << sniffer::svPlayable;
+    QTest::newRow("mp3 without tags") << QByteArray::fromHex("fffb9064000000000000000000000000")
+                                      << sniffer::svUnknown;
+
+    QTest::newRow("png") << QByteArray::fromHex("89504e470d0a1a0a0000000d49484452") << sniffer::svUnplayable;
+    QTest::newRow("jpeg") << QByteArray::fromHex("ffd8ffe000104a46494600010101") << sniffer::svUnplayable;
+    QTest::newRow("webp") << QByteArray::fromHex("52494646a40a000057454250565038")
+                          << sniffer::svUnplayable;
+    QTest::newRow("zip") << QByteArray::fromHex("504b0304140000000800") << sniffer::svUnplayable;
+    QTest::newRow("text") << QByteArray("1. Intro\n2. Outro\n") << sniffer::svUnplayable;
+    QTest::newRow("m3u") << QByteArray("#EXTM3U\n/music/a.mp3\n") << sniffer::svUnknown;
+    QTest::newRow("empty") << QByteArray() << sniffer::svUnplayable;
+}
+
+void tst_sniffer::sniff()
+{
+    QFETCH(QByteArray, header);
+    QFETCH(sniffer::verdict, expected);
+
+    QFile file(dir.filePath(QString::number(written++)));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QCOMPARE(file.write(header), qint64(header.size()));
+    file.close();
+    QCOMPARE(int(sniffer::sniff(file.fileName())), int(expected));
+}
+
+void tst_sniffer::missingFile()
+{
+    // Whatever it is that can't be opened, mpv may know better.
+    QCOMPARE(int(sniffer::sniff(dir.filePath("not there"))), int(sniffer::svUnknown));
+}
+
+QTEST_APPLESS_MAIN(tst_sniffer)
+
+#include "tst_sniffer.moc"
@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# Unit tests.  Build and run each with qmake && make && make check.
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    benchmarks \
+    indexedqueue \
+    player \
+    prober \
+    searchindex \
+    sniffer \
+    validator
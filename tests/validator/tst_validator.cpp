@@ -0,0 +1,97 @@
+#include <QtTest>
+#include <QtConcurrent>
+#include <QTemporaryDir>
+#include <QSemaphore>
+#include "validator.h"
+
+/* The first case runs against the real disk.  The other stands in two mounts
+ * of its own, /fast and /dead, the second of which never answers until the
+ * test is over, just like a share whose server went away.
+ */
+
+class stallingFilesystem : public validator::filesystem
+{
+public:
+    QStringList mountPoints()
+    {
+        return QStringList() << "/" << "/fast" << "/dead";
+    }
+
+    bool list(const QString &dir, QStringList &names)
+    {
+        if (dir.startsWith("/dead/")) {
+            // Pass it on, so that every stuck listing gets to go.
+            unstall.acquire();
+            unstall.release();
+            return false;
+        }
+        names = QStringList() << "here.mp3";
+        return true;
+    }
+
+    bool exists(const QString &path)
+    {
+        return path.endsWith("/here.mp3");
+    }
+
+    QSemaphore unstall;
+};
+
+// The listings stuck on /dead outlive the test that started them.
+static stallingFilesystem stalling;
+
+class tst_validator : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void missingFiles();
+    void deadMountKeepsToItself();
+    void cleanupTestCase();
+};
+
+void tst_validator::missingFiles()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QFile file(dir.filePath("here.mp3"));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.close();
+
+    QStringList entries;
+    entries << dir.filePath("here.mp3") << dir.filePath("gone.mp3")
+            << dir.filePath("no such dir/gone.mp3");
+    QCOMPARE(validator::missingEntries(entries),
+             QStringList() << dir.filePath("gone.mp3") << dir.filePath("no such dir/gone.mp3"));
+}
+
+void tst_validator::deadMountKeepsToItself()
+{
+    validator::setFilesystem(&stalling);
+
+    // Plenty of playlists at once, as at startup, each with more directories
+    // on the dead mount than it has threads, and each with a directory of its
+    // own on the live one, so none of them can get by on the others' luck.
+    QList<QFuture<QStringList> > calls;
+    for (int i = 0; i < 16; i++) {
+        QStringList entries;
+        for (int d = 0; d < 8; d++)
+            entries << QString("/dead/%1/here.mp3").arg(d);
+        entries << QString("/fast/%1/here.mp3").arg(i) << QString("/fast/%1/gone.mp3").arg(i);
+        calls.append(QtConcurrent::run(&validator::missingEntries, entries));
+    }
+    // Nothing on /dead can be declared missing, but /fast must still be
+    // checked for every one of them.
+    for (int i = 0; i < calls.count(); i++)
+        QCOMPARE(calls[i].result(), QStringList() << QString("/fast/%1/gone.mp3").arg(i));
+}
+
+void tst_validator::cleanupTestCase()
+{
+    stalling.unstall.release();
+    validator::setFilesystem(NULL);
+}
+
+QTEST_APPLESS_MAIN(tst_validator)
+
+#include "tst_validator.moc"
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Finding the entries that are gone, and not waiting on dead shares to do it.
+# See tst_validator.cpp.
+#
+#-------------------------------------------------
+
+QT       += core concurrent testlib
+QT       -= gui
+
+TARGET = tst_validator
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += tst_validator.cpp \
+    ../../validator.cpp \
+    ../../tracer.cpp
+
+HEADERS  += ../../validator.h \
+    ../../tracer.h
@@ -0,0 +1,151 @@
+#include "tracer.h"
+#include <QCoreApplication>
+#include <QThread>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+// Write out once this much has built up, in bytes.
+static const int FLUSH_SIZE = 64 * 1024;
+
+QAtomicInt tracer::enabled(qEnvironmentVariableIsSet("MPLAYLIST_TRACE"));
+
+// Every timestamp is taken against this, from as early as we can manage.
+static QElapsedTimer &traceClock()
+{
+    static QElapsedTimer clock;
+    if (!clock.isValid())
+        clock.start();
+    return clock;
+}
+
+// Started as we load, as the trace itself may not be opened until later,
+// and before there are any other threads to race us to it.
+static void startTraceClock()
+{
+    traceClock();
+}
+Q_CONSTRUCTOR_FUNCTION(startTraceClock)
+
+tracer *tracer::instance()
+{
+    static tracer trace;
+    return &trace;
+}
+
+tracer::tracer() :
+    first(true), pid(QCoreApplication::applicationPid()), threadCount(0)
+{
+    traceClock();
+    if (!enabled)
+        return;
+    file.setFileName(QString::fromLocal8Bit(qgetenv("MPLAYLIST_TRACE")));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("Could not open the trace file %s", qPrintable(file.fileName()));
+        enabled.storeRelease(0);
+        return;
+    }
+    file.write("[\n");
+}
+
+tracer::~tracer()
+{
+    QMutexLocker lock(&mutex);
+    if (!file.isOpen())
+        return;
+    flush();
+    file.write("\n]\n");
+    file.close();
+    enabled.storeRelease(0);
+}
+
+qint64 tracer::now()
+{
+    return traceClock().nsecsElapsed() / 1000;
+}
+
+void tracer::complete(const char *name, qint64 start, qint64 duration, const QString &detail)
+{
+    QJsonObject event;
+    event.insert("name", QString::fromLatin1(name));
+    event.insert("cat", QString("mplaylist"));
+    event.insert("ph", QString("X"));
+    event.insert("ts", start);
+    event.insert("dur", duration);
+    event.insert("pid", pid);
+    event.insert("tid", threadId());
+    if (!detail.isEmpty()) {
+        QJsonObject args;
+        args.insert("detail", detail);
+        event.insert("args", args);
+    }
+    append(QJsonDocument(event).toJson(QJsonDocument::Compact));
+}
+
+void tracer::instant(const char *name, const QString &detail)
+{
+    QJsonObject event;
+    event.insert("name", QString::fromLatin1(name));
+    event.insert("cat", QString("mplaylist"));
+    event.insert("ph", QString("i"));
+    event.insert("s", QString("p"));
+    event.insert("ts", now());
+    event.insert("pid", pid);
+    event.insert("tid", threadId());
+    if (!detail.isEmpty()) {
+        QJsonObject args;
+        args.insert("detail", detail);
+        event.insert("args", args);
+    }
+    append(QJsonDocument(event).toJson(QJsonDocument::Compact));
+}
+
+int tracer::threadId()
+{
+    // Thread handles mean nothing to a trace viewer, so each thread gets a
+    // small number, and a name the first time it turns up.
+    if (threadIds.hasLocalData())
+        return threadIds.localData();
+    int id;
+    {
+        QMutexLocker lock(&mutex);
+        id = ++threadCount;
+    }
+    threadIds.setLocalData(id);
+
+    QThread *thread = QThread::currentThread();
+    QString name = thread->objectName();
+    if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+        name = "gui";
+    else if (name.isEmpty())
+        name = thread->metaObject()->className();
+    QJsonObject args;
+    args.insert("name", QString("%1 %2").arg(name).arg(id));
+    QJsonObject event;
+    event.insert("name", QString("thread_name"));
+    event.insert("ph", QString("M"));
+    event.insert("pid", pid);
+    event.insert("tid", id);
+    event.insert("args", args);
+    append(QJsonDocument(event).toJson(QJsonDocument::Compact));
+    return id;
+}
+
+void tracer::append(const QByteArray &event)
+{
+    QMutexLocker lock(&mutex);
+    if (!file.isOpen())
+        return;
+    if (!first)
+        buffer.append(",\n");
+    first = false;
+    buffer.append(event);
+    if (buffer.size() >= FLUSH_SIZE)
+        flush();
+}
+
+void tracer::flush()
+{
+    file.write(buffer);
+    file.flush();
+    buffer.clear();
+}
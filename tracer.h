@@ -0,0 +1,90 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QString>
+#include <QFile>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QThreadStorage>
+#include <QByteArray>
+
+/* When startup or an edit feels slow, guessing which of the storage, the
+ * loaders or the gui is to blame is a waste of everyone's time.  Run with
+ * MPLAYLIST_TRACE set to a file name, and every TRACE_SCOPE below that was
+ * entered is written to it as a Chrome trace event, with the thread it ran
+ * on.  Load the file in chrome://tracing or ui.perfetto.dev, or attach it to
+ * a bug report.
+ *
+ * With the variable unset, a scope costs a test of a static flag on the way
+ * in and out.  Building with MPLAYLIST_NO_TRACE defined gets rid of even
+ * that.
+ *
+ * Events are written out in batches as we go, without the closing bracket
+ * until we exit.  Trace viewers don't mind it missing, so a trace from a
+ * session that crashed can still be loaded.
+ *
+ * The file is opened by the first event, so nothing may be traced before
+ * we know we are the copy that stays (see main.cpp); a launch that only
+ * forwards its command line would truncate the running copy's trace.  The
+ * clock starts as we load regardless.
+ */
+
+class tracer
+{
+public:
+    static tracer *instance();
+    ~tracer();
+
+    static bool isEnabled() { return enabled.loadAcquire(); }
+    static qint64 now();
+    // A span that started at start, in microseconds on now()'s clock.
+    void complete(const char *name, qint64 start, qint64 duration, const QString &detail);
+    // Something that happened at a single point in time.
+    void instant(const char *name, const QString &detail = QString());
+
+    class scope {
+    public:
+        explicit scope(const char *name, const QString &detail = QString())
+            : name(name), detail(isEnabled() ? detail : QString()),
+              start(isEnabled() ? now() : -1) {}
+        ~scope() {
+            if (start >= 0)
+                instance()->complete(name, start, now() - start, detail);
+        }
+    private:
+        const char *name;
+        QString detail;
+        qint64 start;
+    };
+
+private:
+    tracer();
+
+    // Read from every thread, and cleared on the way out.
+    static QAtomicInt enabled;
+    QMutex mutex;
+    QFile file;
+    QByteArray buffer;
+    bool first;
+    qint64 pid;
+    int threadCount;
+    QThreadStorage<int> threadIds;
+
+    int threadId();
+    void append(const QByteArray &event);
+    void flush();
+};
+
+#ifdef MPLAYLIST_NO_TRACE
+#define TRACE_SCOPE(...)
+#define TRACE_INSTANT(...)
+#else
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+#define TRACE_SCOPE(...) tracer::scope TRACE_JOIN(traceScope, __LINE__)(__VA_ARGS__)
+#define TRACE_INSTANT(...) \
+    do { if (tracer::isEnabled()) tracer::instance()->instant(__VA_ARGS__); } while (0)
+#endif
+
+#endif // TRACER_H
@@ -0,0 +1,296 @@
+#include "validator.h"
+#include "tracer.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QSharedPointer>
+#include <QStorageInfo>
+
+// How long a directory listing is trusted for, in milliseconds.
+static const qint64 CACHE_LIFETIME = 10000;
+// How long we wait on each mount before giving up on it, in milliseconds.
+static const qint64 MOUNT_TIMEOUT = 3000;
+// How many directories of the same mount are listed at once.
+static const int MOUNT_PARALLELISM = 4;
+
+namespace {
+
+struct dirListing {
+    QSet<QString> names;
+    qint64 stamp;
+};
+
+// Everything here is shared between the callers and the listing threads, and
+// is guarded by cacheMutex.
+QMutex cacheMutex;
+QHash<QString, dirListing> cache;
+QHash<QString, qint64> stalledMounts;
+QStringList mounts;
+qint64 mountsStamp = -CACHE_LIFETIME;
+validator::filesystem realFilesystem;
+validator::filesystem *currentFilesystem = &realFilesystem;
+
+QElapsedTimer &uptime()
+{
+    static QElapsedTimer timer;
+    if (!timer.isValid())
+        timer.start();
+    return timer;
+}
+
+QThreadPool *listingPool(const QString &mount)
+{
+    // One for each mount, however many playlists are being checked, so that
+    // threads stuck on a dead one can't keep the others waiting.  They are
+    // deliberately leaked.  A thread stuck on a dead mount would otherwise
+    // keep the pool's destructor, and hence the program, from exiting.
+    static QMutex mutex;
+    static QHash<QString, QThreadPool*> pools;
+    QMutexLocker lock(&mutex);
+    QThreadPool *&pool = pools[mount];
+    if (!pool) {
+        pool = new QThreadPool;
+        pool->setMaxThreadCount(MOUNT_PARALLELISM);
+    }
+    return pool;
+}
+
+QString normalizedName(const QString &name)
+{
+#ifdef Q_OS_WIN
+    return name.toLower();
+#else
+    return name;
+#endif
+}
+
+}
+
+QStringList validator::filesystem::mountPoints()
+{
+    // /proc/self/mounts can be read without touching the mounts themselves,
+    // which QStorageInfo cannot promise.
+    QStringList points;
+    QFile file("/proc/self/mounts");
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        foreach (const QByteArray &line, file.readAll().split('\n')) {
+            QByteArray point = line.split(' ').value(1);
+            if (!point.isEmpty())
+                points.append(QString::fromLocal8Bit(point.replace("\\040", " ")));
+        }
+    } else {
+        foreach (const QStorageInfo &info, QStorageInfo::mountedVolumes())
+            points.append(info.rootPath());
+    }
+    return points;
+}
+
+bool validator::filesystem::list(const QString &dir, QStringList &names)
+{
+    QDir d(dir);
+    if (!d.isReadable())
+        return false;
+    names = d.entryList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+    return true;
+}
+
+bool validator::filesystem::exists(const QString &path)
+{
+    return QFileInfo(path).exists();
+}
+
+namespace {
+
+QString mountOf(const QString &dir)
+{
+    QString best;
+    foreach (const QString &point, mounts) {
+        if (point.length() <= best.length())
+            continue;
+        if (dir == point || dir.startsWith(point.endsWith('/') ? point : point + '/'))
+            best = point;
+    }
+    return best;
+}
+
+// Each mount gets MOUNT_TIMEOUT of its own, from when its first listing
+// actually started, since its threads may still be busy with listings from
+// some other playlist.
+struct validation {
+    QMutex mutex;
+    QWaitCondition done;
+    QHash<QString, QSet<QString> > results;
+    QHash<QString, int> pending;
+    QHash<QString, qint64> started;
+};
+
+class listingTask : public QRunnable
+{
+public:
+    listingTask(QSharedPointer<validation> v, validator::filesystem *fs, const QString &mount,
+                const QHash<QString, QStringList> &dirs)
+        : v(v), fs(fs), mount(mount), dirs(dirs) {}
+
+    void run()
+    {
+        {
+            QMutexLocker lock(&v->mutex);
+            if (!v->started.contains(mount))
+                v->started.insert(mount, uptime().elapsed());
+        }
+        QHash<QString, QStringList>::const_iterator i;
+        for (i = dirs.constBegin(); i != dirs.constEnd(); ++i) {
+            QDir dir(i.key());
+            QSet<QString> names;
+            QStringList listed;
+            bool cacheable = fs->list(i.key(), listed);
+            if (cacheable) {
+                foreach (const QString &name, listed)
+                    names.insert(normalizedName(name));
+            } else {
+                // No read permission on the directory does not mean the files
+                // in it are gone, so fall back to asking about each of them.
+                foreach (const QString &name, i.value())
+                    if (fs->exists(dir.filePath(name)))
+                        names.insert(normalizedName(name));
+            }
+            {
+                QMutexLocker lock(&cacheMutex);
+                if (cacheable) {
+                    dirListing &listing = cache[i.key()];
+                    listing.names = names;
+                    listing.stamp = uptime().elapsed();
+                }
+            }
+            QMutexLocker lock(&v->mutex);
+            v->results.insert(i.key(), names);
+        }
+        QMutexLocker lock(&v->mutex);
+        v->pending[mount]--;
+        v->done.wakeAll();
+    }
+
+private:
+    QSharedPointer<validation> v;
+    validator::filesystem *fs;
+    QString mount;
+    QHash<QString, QStringList> dirs;
+};
+
+}
+
+QStringList validator::missingEntries(const QStringList &entries)
+{
+    TRACE_SCOPE("validator::missingEntries");
+    // Sort the entries into directories, and look up what we already know.
+    QHash<QString, QStringList> byDir;
+    foreach (const QString &s, entries) {
+        QFileInfo info(s);
+        byDir[info.absolutePath()].append(info.fileName());
+    }
+
+    QSharedPointer<validation> v(new validation);
+    QHash<QString, QHash<QString, QStringList> > byMount;
+    filesystem *fs;
+    {
+        QMutexLocker lock(&cacheMutex);
+        fs = currentFilesystem;
+        qint64 now = uptime().elapsed();
+        if (now - mountsStamp >= CACHE_LIFETIME) {
+            mounts = fs->mountPoints();
+            mountsStamp = now;
+        }
+        QHash<QString, QStringList>::const_iterator i;
+        for (i = byDir.constBegin(); i != byDir.constEnd(); ++i) {
+            QHash<QString, dirListing>::const_iterator cached = cache.constFind(i.key());
+            if (cached != cache.constEnd() && now - cached->stamp < CACHE_LIFETIME) {
+                v->results.insert(i.key(), cached->names);
+                continue;
+            }
+            // A mount that stalled recently is given a rest before we try
+            // it again.
+            QString mount = mountOf(i.key());
+            if (now - stalledMounts.value(mount, -CACHE_LIFETIME) >= CACHE_LIFETIME)
+                byMount[mount].insert(i.key(), i.value());
+        }
+    }
+
+    // Hand each mount's directories to its own few threads, so one slow
+    // mount cannot hold up the others.
+    QHash<QString, QHash<QString, QStringList> >::const_iterator m;
+    for (m = byMount.constBegin(); m != byMount.constEnd(); ++m) {
+        QList<QHash<QString, QStringList> > shares;
+        QHash<QString, QStringList>::const_iterator d;
+        int n = 0;
+        for (d = m->constBegin(); d != m->constEnd(); ++d, ++n) {
+            if (shares.count() < MOUNT_PARALLELISM)
+                shares.append(QHash<QString, QStringList>());
+            shares[n % MOUNT_PARALLELISM].insert(d.key(), d.value());
+        }
+        foreach (const QHash<QString, QStringList> &share, shares) {
+            QMutexLocker lock(&v->mutex);
+            v->pending[m.key()]++;
+            lock.unlock();
+            listingPool(m.key())->start(new listingTask(v, fs, m.key(), share));
+        }
+    }
+
+    // A mount that hasn't even started by the time it would have run out is
+    // stuck behind its own earlier listings, which have stalled, and counts
+    // as stalled itself.
+    qint64 queuedAt = uptime().elapsed();
+    QSet<QString> expired;
+    QMutexLocker lock(&v->mutex);
+    forever {
+        qint64 now = uptime().elapsed();
+        qint64 wake = -1;
+        QHash<QString, int>::const_iterator p;
+        for (p = v->pending.constBegin(); p != v->pending.constEnd(); ++p) {
+            if (p.value() <= 0 || expired.contains(p.key()))
+                continue;
+            qint64 deadline = v->started.value(p.key(), queuedAt) + MOUNT_TIMEOUT;
+            if (now >= deadline)
+                expired.insert(p.key());
+            else if (wake < 0 || deadline < wake)
+                wake = deadline;
+        }
+        if (wake < 0)
+            break;
+        v->done.wait(&v->mutex, (unsigned long)(wake - now));
+    }
+    QHash<QString, QSet<QString> > results = v->results;
+    lock.unlock();
+
+    // Whichever mounts didn't finish in time are left alone for a while.
+    if (!expired.isEmpty()) {
+        QMutexLocker cacheLock(&cacheMutex);
+        foreach (const QString &mount, expired)
+            stalledMounts.insert(mount, uptime().elapsed());
+    }
+
+    // Only entries in a directory we managed to list can be declared missing.
+    QStringList missing;
+    foreach (const QString &s, entries) {
+        QFileInfo info(s);
+        QHash<QString, QSet<QString> >::const_iterator r = results.constFind(info.absolutePath());
+        if (r != results.constEnd() && !r->contains(normalizedName(info.fileName())))
+            missing.append(s);
+    }
+    return missing;
+}
+
+void validator::setFilesystem(filesystem *fs)
+{
+    QMutexLocker lock(&cacheMutex);
+    currentFilesystem = fs ? fs : &realFilesystem;
+    cache.clear();
+    stalledMounts.clear();
+    mountsStamp = -CACHE_LIFETIME;
+}
@@ -0,0 +1,46 @@
+#ifndef VALIDATOR_H
+#define VALIDATOR_H
+
+#include <QStringList>
+
+/* Checking whether every entry of a playlist still exists used to be a stat()
+ * per entry, which is fine on a local disk and miserable on a network share.
+ * Instead we group the entries by directory and list each directory once,
+ * spreading the directories of each mount over a few threads.  Each mount
+ * has threads of its own, shared by everybody asking about it, so a dead
+ * share can only ever tie up its own.  A mount that does not answer in time
+ * is treated as if everything on it exists, since a stalled share is no
+ * reason to lose track of what is on it.
+ *
+ * Listings are kept for a short while, so that several playlists pointing at
+ * the same directories at startup only pay for them once.
+ */
+
+class validator
+{
+public:
+    // Returns the entries which are known to be missing.  Each mount gets at
+    // most MOUNT_TIMEOUT milliseconds to answer, so this can block for a
+    // while and shouldn't be called from the gui thread.
+    static QStringList missingEntries(const QStringList &entries);
+
+    // Where the mounts and listings come from.  Only the tests use anything
+    // but the real thing, to have a share that stalls when they say so.
+    // Everything but mountPoints is called from the listing threads.
+    class filesystem {
+    public:
+        virtual ~filesystem() {}
+        virtual QStringList mountPoints();
+        // False if the directory can't be listed.
+        virtual bool list(const QString &dir, QStringList &names);
+        virtual bool exists(const QString &path);
+    };
+    // Not ours to delete.  NULL goes back to the real thing.  Whatever was
+    // learned from the last one is forgotten.
+    static void setFilesystem(filesystem *fs);
+
+private:
+    validator();
+};
+
+#endif // VALIDATOR_H
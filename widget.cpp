@@ -1,38 +1,128 @@
 #include "widget.h"
 #include "ui_widget.h"
-#include "player.h"
+#include "tracer.h"
 #include <qdrag.h>
 #include <qmimedata.h>
 #include <QDebug>
 #include <QProcess>
 #include <QFileDialog>
+#include <QFile>
 #include <QFileInfo>
+#include <QApplication>
+#include <QSettings>
+#include <QLoggingCategory>
+#include <algorithm>
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
 
+// How much memory a loaded playlist costs, for whoever wants to know.  Turn
+// it on with QT_LOGGING_RULES="mplaylist.memory.debug=true".
+Q_LOGGING_CATEGORY(memoryLog, "mplaylist.memory", QtWarningMsg)
 
-Widget::Widget(QWidget *parent) :
+// Ask the walker for more once the prober has fewer than this many files
+// left to decide.
+static const int WALK_LOW_WATER = 1024;
+
+// How long the note about files left out stays up after the last of them.
+static const int SKIPPED_NOTE_TIME = 5000;
+
+// How far the move buttons take the selection with shift held, unless the
+// settings say otherwise (queue/moveStep).
+static const int MOVE_STEP = 10;
+
+
+Widget::Widget(scheduler *playback, QWidget *parent) :
     QWidget(parent),
     ui(new Ui::Widget),
-    p()
+    playback(playback),
+    playWhenAdded(false),
+    skipped(0)
 {
     ui->setupUi(this);
-    connect(&p, SIGNAL(playbackFinished(QString)), SLOT(player_playbackFinished(QString)));
+    ui->listView->setModel(&model);
+    ui->probeProgress->hide();
+    ui->cancelProbeButton->hide();
+    ui->skippedLabel->hide();
+    skippedTimer.setSingleShot(true);
+    skippedTimer.setInterval(SKIPPED_NOTE_TIME);
+    connect(&skippedTimer, SIGNAL(timeout()), SLOT(skippedTimer_timeout()));
+    connect(playback, SIGNAL(playbackFinished(QObject*,QString)), SLOT(playback_playbackFinished(QObject*,QString)));
+    playback->shareProbes(&probes);
+    connect(&probes, SIGNAL(accepted(QStringList)), SLOT(probes_accepted(QStringList)));
+    connect(&probes, SIGNAL(progress(int,int)), SLOT(probes_progress(int,int)));
+    connect(&probes, SIGNAL(finished()), SLOT(probes_finished()));
+    connect(&walker, SIGNAL(found(QStringList,int)), SLOT(walker_found(QStringList,int)));
+    connect(&walker, SIGNAL(finished()), SLOT(walker_finished()));
 }
 
 Widget::~Widget()
 {
+    if (playback)
+        playback->release(this);
     delete ui;
 }
 
-void Widget::setQueue(const QStringList &queue)
+void Widget::setQueue(const QStringList &queue, const QStringList &missing)
+{
+    TRACE_SCOPE("Widget::setQueue", title);
+    playback->stopFile(this);
+    model.setQueue(queue, QSet<QString>(missing.begin(), missing.end()));
+    setCurrentEntry(nextPlayable(0));
+    // Once whoever loaded the list has let go of their copy of it.
+    if (memoryLog().isDebugEnabled())
+        QTimer::singleShot(0, this, SLOT(reportMemory()));
+}
+
+void Widget::reportMemory()
+{
+    qint64 resident = -1;
+#ifdef Q_OS_LINUX
+    QFile statm("/proc/self/statm");
+    if (statm.open(QIODevice::ReadOnly))
+        resident = statm.readAll().split(' ').value(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#endif
+    qCDebug(memoryLog) << title << "has" << model.count() << "entries; path arena"
+                       << patharena::instance()->bytesUsed() / 1024 << "KiB, resident"
+                       << resident / 1024 << "KiB";
+}
+
+void Widget::mergeQueue(const QStringList &queue, const QStringList &missing)
 {
-    p.stopFile();
-    this->queue = queue;
-    repopulateList(false);
+    TRACE_SCOPE("Widget::mergeQueue", title);
+    // The playlist was changed outside of the program.  Such edits tend to be
+    // an append here or a removal there, so we keep whatever the two queues
+    // have in common at either end and only replace the rows in between.
+    // Playback carries on regardless.
+    const QStringList &current = model.queue();
+    int prefix = 0;
+    int common = qMin(current.count(), queue.count());
+    while (prefix < common && current.at(prefix) == queue.at(prefix))
+        prefix++;
+    int suffix = 0;
+    while (suffix < common - prefix
+           && current.at(current.count() - 1 - suffix) == queue.at(queue.count() - 1 - suffix))
+        suffix++;
+
+    model.setMissing(QSet<QString>(missing.begin(), missing.end()));
+    model.replace(prefix, current.count() - prefix - suffix,
+                  queue.mid(prefix, queue.count() - prefix - suffix));
+    updateNextFile();
 }
 
 QStringList Widget::getQueue()
 {
-    return queue;
+    return model.queue();
+}
+
+int Widget::count()
+{
+    return model.count();
+}
+
+bool Widget::isBusy()
+{
+    return playback->isPlaying(this) || probes.isBusy() || walker.isBusy();
 }
 
 void Widget::setTitle(const QString &title)
@@ -45,6 +135,26 @@ QString Widget::getTitle()
     return title;
 }
 
+void Widget::addFiles(const QStringList &paths)
+{
+    addPaths(paths);
+}
+
+void Widget::play()
+{
+    int index = currentEntry();
+    if (index >= 0 && index < model.count())
+        playIndex(index);
+    else if (probes.isBusy() || walker.isBusy())
+        playWhenAdded = true;
+}
+
+void Widget::stop()
+{
+    playWhenAdded = false;
+    playback->kill(this);
+}
+
 void Widget::dragEnterEvent(QDragEnterEvent *e)
 {
     if (e->mimeData()->hasUrls()) {
@@ -54,114 +164,347 @@ void Widget::dragEnterEvent(QDragEnterEvent *e)
 
 void Widget::dropEvent(QDropEvent *e)
 {
-    // Because repopulating a list is relatively expensive, (we do things very
-    // simply if we at all can,) we only update our gui if we really need to.
-    // Though not really, average use-cases aren't expensive unless you're
-    // dropping a copious amount of files all at once.  However, now we are
-    // checking if a file is valid, so this isn't so quick anymore.  If I get
-    // complaints about freezes, I'll spin this into a thread.
-    bool changed = false;
-    foreach (const QUrl &url, e->mimeData()->urls()) {
-        const QString &fileName = url.toLocalFile();
-        if (p.checkFile(fileName)) {
-            queue.append(fileName);
-            changed = true;
-        }
-    }
-    if (changed) {
-        repopulateList();
-        emit playlistChanged(this);
-    }
+    QStringList paths;
+    foreach (const QUrl &url, e->mimeData()->urls())
+        paths.append(url.toLocalFile());
+    addPaths(paths);
 }
 
-void Widget::player_playbackFinished(const QString &fileJustPlayed)
+void Widget::playback_playbackFinished(QObject *owner, const QString &fileJustPlayed)
 {
+    TRACE_SCOPE("Widget::playbackFinished", fileJustPlayed);
+    if (owner != this)
+        return;
     // When playback is finished, the item is removed and playback proceeds
     // on the next item, if there is one.  I don't want to store positions at
     // present, it would unduly complicate the simple storage mechanism all
     // for the purpose of storing one index into a playlist.  Playlists may
     // change when the program isn't running anyway, so don't bother.
-    int index = ui->listWidget->currentRow();
-    queue.removeAll(fileJustPlayed);
-    repopulateList();
-    emit playlistChanged(this);
-    if (queue.length() > index)
-        p.playFile(queue.at(index));
-}
-
-void Widget::repopulateList(bool preserveSelection)
-{
-    // I am not using a bunch of model-view classes just to do this "more
-    // correctly" -- that would complicate the code and imo head towards
-    // unreadable spaghetti territory.  Instead, we simply reload the list
-    // widget whenever the queue changes.
-    int index;
-    if (preserveSelection)
-        index = ui->listWidget->currentRow();
-    ui->listWidget->clear();
-    foreach (QString q, queue) {
-        ui->listWidget->addItem(QFileInfo(q).completeBaseName());
+    int index = currentEntry();
+    QList<int> played = model.indexesOf(fileJustPlayed);
+    for (int i = played.count() - 1; i >= 0; i--) {
+        model.removeAt(played.at(i));
+        emit entryRemoved(this, played.at(i));
+    }
+    index = nextPlayable(index);
+    if (index >= 0) {
+        setCurrentEntry(index);
+        playIndex(index);
     }
-    ui->listWidget->setCurrentRow(preserveSelection ? index : 0);
 }
 
-void Widget::on_listWidget_doubleClicked(const QModelIndex &index)
+void Widget::addPaths(const QStringList &paths)
 {
-    if (queue.length() > index.row())
-        p.playFile(queue.at(index.row()));
+    // Checking whether a file is valid isn't quick, so the files are handed
+    // to the prober, which checks several at once in the background.  They
+    // turn up in probes_accepted as they pass.  Directories go to the
+    // walker first, which hands their files over as it finds them.
+    QStringList files;
+    QStringList directories;
+    foreach (const QString &path, paths) {
+        if (QFileInfo(path).isDir())
+            directories.append(path);
+        else
+            files.append(path);
+    }
+    probes.probe(notQueued(files));
+    if (!directories.isEmpty()) {
+        walker.walk(directories);
+        // Until the first batch turns up, all we know is that we're busy.
+        if (!probes.isBusy()) {
+            ui->probeProgress->setMaximum(0);
+            ui->probeProgress->show();
+            ui->cancelProbeButton->show();
+        }
+    }
 }
 
-void Widget::on_moveUpButton_clicked()
+void Widget::feedProbes()
 {
-    int index = ui->listWidget->currentRow();
-    if (index > 0) {
-        queue.move(index, index - 1);
-        repopulateList();
-        ui->listWidget->setCurrentRow(index - 1);
-        emit playlistChanged(this);
+    // Keep the prober a few batches deep, and no more, so a huge library
+    // doesn't all end up sitting in its queue.
+    if (walker.isBusy() && probes.pending() < WALK_LOW_WATER)
+        walker.proceed();
+}
+
+QStringList Widget::notQueued(const QStringList &files)
+{
+    // Files go in as often as they're given, unless queue/skipDuplicates is
+    // set, in which case a file only goes in once and dropping a folder
+    // again only adds what is new in it.
+    if (!QSettings().value("queue/skipDuplicates", false).toBool())
+        return files;
+    QStringList fresh;
+    QSet<QString> seen;
+    foreach (const QString &file, files) {
+        if (!model.contains(file) && !seen.contains(file)) {
+            seen.insert(file);
+            fresh.append(file);
+        }
     }
+    // Say so, or it looks like the drop went missing.
+    if (fresh.count() < files.count()) {
+        skipped += files.count() - fresh.count();
+        ui->skippedLabel->setText(tr("%n file(s) already in the playlist", "", skipped));
+        ui->skippedLabel->show();
+        skippedTimer.start();
+    }
+    return fresh;
 }
 
-void Widget::on_moveDownButton_clicked()
+int Widget::currentEntry()
+{
+    return model.toQueue(ui->listView->currentIndex().row());
+}
+
+void Widget::setCurrentEntry(int index)
+{
+    ui->listView->setCurrentIndex(model.index(model.toRow(index)));
+}
+
+void Widget::playIndex(int index)
 {
-    int index = ui->listWidget->currentRow();
-    if (index < queue.length() - 1) {
-        queue.move(index, index + 1);
-        repopulateList();
-        ui->listWidget->setCurrentRow(index + 1);
-        emit playlistChanged(this);
+    playing = model.at(index);
+    playback->playFile(this, playing);
+    updateNextFile();
+}
+
+int Widget::upNext()
+{
+    // Whatever playback_playbackFinished would go on to, were the file that
+    // is playing to finish right now: the first playable entry from the
+    // current one on, once every copy of the played file has gone.
+    int index = currentEntry();
+    if (index < 0)
+        return -1;
+    foreach (int played, model.indexesOf(playing)) {
+        if (played > index)
+            break;
+        index++;
     }
+    while (index < model.count() && (model.isMissing(index) || model.at(index) == playing))
+        index++;
+    return index < model.count() ? index : -1;
+}
+
+void Widget::updateNextFile()
+{
+    // Let the player know what is likely to come next, so that it can get
+    // it ready ahead of time.  The persistent player queues it up in mpv, so
+    // this has to follow every edit, or mpv rolls over to whatever used to
+    // be next, even if it has since been removed.
+    if (playing.isEmpty() || !playback->isPlaying(this))
+        return;
+    int next = upNext();
+    playback->setNextFile(this, next >= 0 ? model.at(next) : QString());
+}
+
+int Widget::nextPlayable(int index)
+{
+    if (index < 0)
+        return -1;
+    while (index < model.count() && model.isMissing(index))
+        index++;
+    return index < model.count() ? index : -1;
+}
+
+void Widget::on_listView_doubleClicked(const QModelIndex &index)
+{
+    int entry = model.toQueue(index.row());
+    if (entry >= 0 && entry < model.count())
+        playIndex(entry);
+}
+
+void Widget::on_filterEdit_textChanged(const QString &text)
+{
+    TRACE_SCOPE("Widget::filter", text);
+    int index = currentEntry();
+    model.setFilter(text);
+    setCurrentEntry(index);
+}
+
+void Widget::on_moveTopButton_clicked()
+{
+    moveSelection(-model.count());
+}
+
+void Widget::on_moveUpButton_clicked()
+{
+    moveSelection(-moveStep());
+}
+
+void Widget::on_moveDownButton_clicked()
+{
+    moveSelection(moveStep());
+}
+
+void Widget::on_moveBottomButton_clicked()
+{
+    moveSelection(model.count());
 }
 
 void Widget::on_removeButton_clicked()
 {
-    int index = ui->listWidget->currentRow();
-    if (index < queue.length()) { // this is probably always true, except when it's not.
-        queue.removeAt(index);
-        repopulateList();
-        emit playlistChanged(this);
+    TRACE_SCOPE("Widget::remove");
+    QList<int> selected = selectedEntries();
+    if (selected.isEmpty())
+        return;
+    int index = selected.first();
+    if (selected.count() == 1) {
+        model.removeAt(index);
+        emit entryRemoved(this, index);
+    } else {
+        model.removeEntries(selected);
+        emit entriesRemoved(this, selected);
+    }
+    setCurrentEntry(qMin(index, model.count() - 1));
+    updateNextFile();
+}
+
+int Widget::moveStep()
+{
+    // Holding shift moves things along faster.
+    if (!(QApplication::keyboardModifiers() & Qt::ShiftModifier))
+        return 1;
+    return qMax(1, QSettings().value("queue/moveStep", MOVE_STEP).toInt());
+}
+
+void Widget::moveSelection(int by)
+{
+    TRACE_SCOPE("Widget::moveSelection");
+    QList<int> selected = selectedEntries();
+    if (selected.isEmpty())
+        return;
+    if (selected.count() == 1) {
+        // One entry can be moved, and journaled, on its own.
+        int from = selected.first();
+        int to = qBound(0, from + qBound(-model.count(), by, model.count()), model.count() - 1);
+        if (from == to)
+            return;
+        model.move(from, to);
+        setCurrentEntry(to);
+        updateNextFile();
+        emit entryMoved(this, from, to);
+        return;
+    }
+
+    // Anything more is one pass over the queue, and one full write.
+    QList<int> moved = model.moveEntries(selected, by);
+    if (moved == selected)
+        return;
+    QItemSelection selection;
+    foreach (int index, moved) {
+        QModelIndex row = model.index(model.toRow(index));
+        if (row.isValid())
+            selection.select(row, row);
+    }
+    ui->listView->selectionModel()->select(selection, QItemSelectionModel::ClearAndSelect);
+    ui->listView->selectionModel()->setCurrentIndex(model.index(model.toRow(moved.first())),
+                                                    QItemSelectionModel::NoUpdate);
+    updateNextFile();
+    emit playlistChanged(this);
+}
+
+QList<int> Widget::selectedEntries()
+{
+    QList<int> selected;
+    foreach (const QModelIndex &index, ui->listView->selectionModel()->selectedIndexes()) {
+        int entry = model.toQueue(index.row());
+        if (entry >= 0 && entry < model.count())
+            selected.append(entry);
     }
+    std::sort(selected.begin(), selected.end());
+    return selected;
 }
 
 void Widget::on_stopButton_clicked()
 {
-    p.kill();
+    stop();
 }
 
 void Widget::on_playButton_clicked()
 {
-    int index = ui->listWidget->currentRow();
-    if (index >= 0 && index < queue.length())
-        p.playFile(queue.at(index));
+    play();
 }
 
 void Widget::on_browseButton_clicked()
 {
-    QStringList files = QFileDialog::getOpenFileNames(this);
-    p.checkFiles(files);
-    if (files.isEmpty())
+    probes.probe(notQueued(QFileDialog::getOpenFileNames(this)));
+}
+
+void Widget::on_browseFolderButton_clicked()
+{
+    QString directory = QFileDialog::getExistingDirectory(this);
+    if (!directory.isEmpty())
+        addPaths(QStringList() << directory);
+}
+
+void Widget::on_cancelProbeButton_clicked()
+{
+    walker.cancel();
+    probes.cancel();
+}
+
+void Widget::walker_found(const QStringList &files, int walk)
+{
+    // Left over from a walk that has since been cancelled.
+    if (walk != walker.currentWalk())
         return;
-    queue.append(files);
-    repopulateList();
-    emit playlistChanged(this);
+    probes.probe(notQueued(files));
+    feedProbes();
+}
+
+void Widget::walker_finished()
+{
+    if (!walker.isBusy() && !probes.isBusy())
+        probes_finished();
+}
+
+void Widget::probes_accepted(const QStringList &files)
+{
+    TRACE_SCOPE("Widget::probes_accepted");
+    // Appending doesn't disturb the rows we already have.  The same file may
+    // have been dropped twice while the first lot was still being checked.
+    QStringList fresh = notQueued(files);
+    if (fresh.isEmpty())
+        return;
+    model.append(fresh);
+    if (currentEntry() < 0)
+        setCurrentEntry(0);
+    emit entriesAppended(this, fresh);
+    if (playWhenAdded) {
+        playWhenAdded = false;
+        int index = model.count() - fresh.count();
+        setCurrentEntry(index);
+        playIndex(index);
+    } else {
+        updateNextFile();
+    }
+}
+
+void Widget::probes_progress(int done, int total)
+{
+    ui->probeProgress->setMaximum(total);
+    ui->probeProgress->setValue(done);
+    ui->probeProgress->show();
+    ui->cancelProbeButton->show();
+    feedProbes();
+}
+
+void Widget::probes_finished()
+{
+    // The walker may have more on the way.
+    if (walker.isBusy()) {
+        feedProbes();
+        return;
+    }
+    playWhenAdded = false;
+    ui->probeProgress->hide();
+    ui->cancelProbeButton->hide();
+}
+
+void Widget::skippedTimer_timeout()
+{
+    skipped = 0;
+    ui->skippedLabel->hide();
 }
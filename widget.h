@@ -3,11 +3,37 @@
 
 #include <QWidget>
 #include <QDropEvent>
-#include "player.h"
+#include <QSet>
+#include <QPointer>
+#include <QTimer>
+#include "scheduler.h"
+#include "prober.h"
+#include "queuemodel.h"
+#include "dirwalker.h"
 
-/* This class keeps track of its own player and tracks a single playlist.  We
+/* This class tracks a single playlist, and has the window's scheduler play
+ * it for us (the scheduler may or may not outlive us on the way out).  We
  * use an event-based approach to process playback.  Instead of marking files
  * as 'read', we remove them from the list when they are fully played.
+ *
+ * Entries whose files could not be found when the playlist was loaded are
+ * kept in the queue, so they are still saved, but the model gives them no
+ * rows and playback skips over them.
+ *
+ * The queue itself lives in a queuemodel, which the list view shows, so an
+ * edit only ever touches the rows it is about.  Files already in the queue
+ * are not added again, and a note under the list says how many were left
+ * out.
+ *
+ * The filter box narrows the list down to matching names; see queuemodel.
+ *
+ * Several entries can be selected and moved or removed together.  A single
+ * entry is still journaled as a single edit, but a batch is done as one pass
+ * over the queue: removals become one journal write, and moves one rewrite
+ * of the playlist.
+ *
+ * Directories, dropped or browsed for, are walked by a dirwalker, which feeds
+ * the prober a batch at a time, and only as fast as the prober keeps up.
  */
 
 namespace Ui {
@@ -19,38 +45,86 @@ class Widget : public QWidget
     Q_OBJECT
 
 public:
-    explicit Widget(QWidget *parent = 0);
+    explicit Widget(scheduler *playback, QWidget *parent = 0);
     ~Widget();
 
-    void setQueue(const QStringList& queue);
+    void setQueue(const QStringList& queue, const QStringList &missing = QStringList());
+    void mergeQueue(const QStringList& queue, const QStringList &missing = QStringList());
     QStringList getQueue();
+    int count();
+    // Playing, or still working through files that were added.  Busy tabs
+    // are never put away by the window.
+    bool isBusy();
     void setTitle(const QString& title);
     QString getTitle();
+    // What the buttons do, for commands from another instance (see
+    // instance.h).  If there is nothing to play yet but files are on their
+    // way, play starts on the first of them to arrive.
+    void addFiles(const QStringList &paths);
+    void play();
+    void stop();
 
 signals:
     void playlistChanged(Widget *widget);
+    // Finer grained versions of the above, so small edits can be journaled
+    // instead of rewriting the whole playlist.
+    void entriesAppended(Widget *widget, const QStringList &entries);
+    void entryRemoved(Widget *widget, int index);
+    // Several at once, as they were numbered before any of them went.
+    void entriesRemoved(Widget *widget, const QList<int> &indexes);
+    void entryMoved(Widget *widget, int from, int to);
 
 protected:
     void dragEnterEvent(QDragEnterEvent *e);
     void dropEvent(QDropEvent *e);
 private slots:
-    void player_playbackFinished(const QString &fileJustPlayed);
-    void on_listWidget_doubleClicked(const QModelIndex &index);
+    void playback_playbackFinished(QObject *owner, const QString &fileJustPlayed);
+    void on_listView_doubleClicked(const QModelIndex &index);
+    void on_filterEdit_textChanged(const QString &text);
+    void on_moveTopButton_clicked();
     void on_moveUpButton_clicked();
     void on_moveDownButton_clicked();
+    void on_moveBottomButton_clicked();
     void on_removeButton_clicked();
     void on_stopButton_clicked();
     void on_playButton_clicked();
     void on_browseButton_clicked();
+    void on_browseFolderButton_clicked();
+    void on_cancelProbeButton_clicked();
+    void walker_found(const QStringList &files, int walk);
+    void walker_finished();
+    void probes_accepted(const QStringList &files);
+    void probes_progress(int done, int total);
+    void probes_finished();
+    void skippedTimer_timeout();
+    void reportMemory();
 
 private:
     int exitState;
     Ui::Widget *ui;
-    player p;
+    QPointer<scheduler> playback;
+    prober probes;
+    dirwalker walker;
     QString title;
-    QStringList queue;
+    queuemodel model;
+    QString playing;
+    bool playWhenAdded;
+    int skipped;
+    QTimer skippedTimer;
 
-    void repopulateList(bool preserveSelection = true);
+    QStringList notQueued(const QStringList &files);
+    void addPaths(const QStringList &paths);
+    void feedProbes();
+    // These are in queue indexes, whatever the filter is showing.
+    QList<int> selectedEntries();
+    int moveStep();
+    void moveSelection(int by);
+    int currentEntry();
+    void setCurrentEntry(int index);
+    int nextPlayable(int index);
+    int upNext();
+    void updateNextFile();
+    void playIndex(int index);
 };
 
 #endif // WIDGET_H
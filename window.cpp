@@ -1,6 +1,7 @@
 #include "window.h"
 #include "ui_window.h"
 #include "widget.h"
+#include "tracer.h"
 #include <QInputDialog>
 #include <QSettings>
 #include <QFileInfo>
@@ -16,30 +17,142 @@ static const QString MSG_NONEXISTANT(QObject::tr("Playlist %1 no longer exists o
 static const QString MSG_UNREAD(QObject::tr("File %1 could not be read"));
 static const QString MSG_UNEXPORTED(QObject::tr("Playlist %1 could not be written to %2"));
 
+// How long a Widget may go unseen before it is put away, in seconds, and how
+// often we go looking for them, in milliseconds.
+static const int EVICT_AFTER = 300;
+static const int EVICT_INTERVAL = 60000;
+
 Window::Window(QWidget *parent) :
     QWidget(parent),
-    ui(new Ui::Window)
+    ui(new Ui::Window),
+    swapping(false),
+    enumerated(false)
 {
+    TRACE_SCOPE("Window::Window");
     ui->setupUi(this);
+    uptime.start();
+    evictAfter = QSettings().value("window/evictAfter", EVICT_AFTER).toLongLong() * 1000;
+    connect(&evictTimer, SIGNAL(timeout()), SLOT(evictTimer_timeout()));
+    if (evictAfter > 0)
+        evictTimer.start(EVICT_INTERVAL);
     connect(ui->tabWidget->tabBar(), SIGNAL(tabMoved(int,int)), SLOT(tabWidget_tabBar_moved()));
-    connect(&store, SIGNAL(playlistFound(QString,QStringList)), SLOT(storage_playlistFound(QString,QStringList)));
+    connect(&store, SIGNAL(playlistPending(QString)), SLOT(storage_playlistPending(QString)));
+    connect(&store, SIGNAL(playlistFound(QString,int)), SLOT(storage_playlistFound(QString,int)));
+    connect(&store, SIGNAL(playlistUnreadable(QString)), SLOT(storage_playlistUnreadable(QString)));
     connect(&store, SIGNAL(finishedEnumerating()), SLOT(storage_finishedEnumerating()));
+    connect(&store, SIGNAL(writeFailed(QString,storage::storeReturns)), SLOT(storage_writeFailed(QString,storage::storeReturns)));
+    connect(&store, SIGNAL(playlistChanged(QString,QStringList,QStringList)), SLOT(storage_playlistChanged(QString,QStringList,QStringList)));
+    connect(&store, SIGNAL(playlistVanished(QString)), SLOT(storage_playlistVanished(QString)));
+    connect(&store, SIGNAL(playlistLoaded(QString,QStringList,QStringList)), SLOT(storage_playlistLoaded(QString,QStringList,QStringList)));
     store.enumPlaylists();
 }
 
 Window::~Window()
 {
+    // Leave a snapshot of what we've got, so next time we can skip parsing
+    // the playlists that nobody touched in the meantime.  Placeholders have
+    // nothing to give, but storage can keep what it had for them.
+    QStringList titles;
+    QList<QStringList> queues;
+    QStringList unloaded;
+    for (int i = 0; i < ui->tabWidget->count(); i++) {
+        Widget *w = widgetAt(i);
+        Placeholder *p = placeholderAt(i);
+        if (w && w->isEnabled()) {
+            titles.append(w->getTitle());
+            queues.append(w->getQueue());
+        } else if (p && p->count() >= 0) {
+            titles.append(p->getTitle());
+            queues.append(QStringList());
+            unloaded.append(p->getTitle());
+        }
+    }
+    store.saveSnapshot(titles, queues, unloaded);
     delete ui;
 }
 
-void Window::addTab(const QString &title, const QStringList &queue)
+void Window::addTab(const QString &title, const QStringList &queue, const QStringList &missing)
+{
+    ui->tabWidget->addTab(makeWidget(title, queue, missing), title);
+}
+
+void Window::addPlaceholder(const QString &title, int count)
+{
+    Placeholder *p = new Placeholder(title);
+    p->setCount(count);
+    p->setEnabled(count >= 0);
+    ui->tabWidget->addTab(p, title);
+}
+
+Widget *Window::makeWidget(const QString &title, const QStringList &queue, const QStringList &missing)
 {
-    Widget* w = new Widget();
+    TRACE_SCOPE("Window::makeWidget", title);
+    Widget* w = new Widget(&playback);
     connect(w, SIGNAL(playlistChanged(Widget*)), SLOT(widget_playlistChanged(Widget*)));
+    connect(w, SIGNAL(entriesAppended(Widget*,QStringList)), SLOT(widget_entriesAppended(Widget*,QStringList)));
+    connect(w, SIGNAL(entryRemoved(Widget*,int)), SLOT(widget_entryRemoved(Widget*,int)));
+    connect(w, SIGNAL(entriesRemoved(Widget*,QList<int>)), SLOT(widget_entriesRemoved(Widget*,QList<int>)));
+    connect(w, SIGNAL(entryMoved(Widget*,int,int)), SLOT(widget_entryMoved(Widget*,int,int)));
     w->setTitle(title);
     if (!queue.empty())
-        w->setQueue(queue);
-    ui->tabWidget->addTab(w, title);
+        w->setQueue(queue, missing);
+    lastShown.insert(w, uptime.elapsed());
+    return w;
+}
+
+void Window::replaceTab(int index, QWidget *page)
+{
+    TRACE_SCOPE("Window::replaceTab");
+    // Shuffling the pages about moves the current tab around, which should
+    // not look like the user switching tabs.
+    QWidget *old = ui->tabWidget->widget(index);
+    bool current = ui->tabWidget->currentIndex() == index;
+    swapping = true;
+    ui->tabWidget->insertTab(index, page, ui->tabWidget->tabText(index));
+    ui->tabWidget->removeTab(index + 1);
+    if (current) {
+        ui->tabWidget->setCurrentIndex(index);
+        shown = page;
+    }
+    swapping = false;
+    lastShown.remove(old);
+    old->deleteLater();
+}
+
+void Window::closeTab(int index)
+{
+    QWidget *page = ui->tabWidget->widget(index);
+    ui->tabWidget->removeTab(index);
+    lastShown.remove(page);
+    page->deleteLater();
+}
+
+int Window::findTab(const QString &title)
+{
+    for (int i = 0; i < ui->tabWidget->count(); i++) {
+        if (titleAt(i) == title)
+            return i;
+    }
+    return -1;
+}
+
+QString Window::titleAt(int index)
+{
+    Widget *w = widgetAt(index);
+    if (w)
+        return w->getTitle();
+    Placeholder *p = placeholderAt(index);
+    return p ? p->getTitle() : QString();
+}
+
+Widget *Window::widgetAt(int index)
+{
+    return qobject_cast<Widget*>(ui->tabWidget->widget(index));
+}
+
+Placeholder *Window::placeholderAt(int index)
+{
+    return qobject_cast<Placeholder*>(ui->tabWidget->widget(index));
 }
 
 void Window::removePlaylist(int index)
@@ -47,16 +160,78 @@ void Window::removePlaylist(int index)
     if (index < 0)
         return;
 
-    Widget *w = reinterpret_cast<Widget*>(ui->tabWidget->widget(index));
-    storage::storeReturns ret = store.removePlaylist(w->getTitle());
+    if (!ui->tabWidget->widget(index)->isEnabled())
+        return;  // still being loaded, leave it alone until it's done
+    QString title = titleAt(index);
+    storage::storeReturns ret = store.removePlaylist(title);
     if (ret != storage::srSuccess) {
-        showFail(ret, w->getTitle());
+        showFail(ret, title);
         return;
     }
-    ui->tabWidget->removeTab(index);
+    closeTab(index);
     saveTabOrder();
 }
 
+void Window::instance_commandReceived(const QString &command, const QString &playlist, const QStringList &files)
+{
+    remoteCommand c;
+    c.command = command;
+    c.playlist = playlist;
+    c.files = files;
+    deferred.append(c);
+    runDeferred();
+}
+
+void Window::runDeferred()
+{
+    if (!enumerated)
+        return;
+    while (!deferred.isEmpty()) {
+        remoteCommand c = deferred.first();
+        if (c.command == "focus") {
+            if (isMinimized())
+                showNormal();
+            raise();
+            activateWindow();
+            deferred.removeFirst();
+            continue;
+        }
+
+        int index = c.playlist.isEmpty() ? ui->tabWidget->currentIndex()
+                                         : findTab(c.playlist);
+        if (index < 0 && c.command == "enqueue") {
+            // Somewhere for the files to go.
+            QString name = c.playlist.isEmpty() ? tr("empty playlist") : c.playlist;
+            storage::storeReturns ret = store.addPlaylist(name);
+            if (ret != storage::srSuccess) {
+                showFail(ret, name);
+                deferred.removeFirst();
+                continue;
+            }
+            addTab(name);
+            saveTabOrder();
+            index = ui->tabWidget->count() - 1;
+        }
+        if (index < 0) {
+            deferred.removeFirst();
+            continue;
+        }
+        Widget *w = widgetAt(index);
+        if (!w) {
+            // Showing the tab gets it loaded, and we carry on from there.
+            ui->tabWidget->setCurrentIndex(index);
+            return;
+        }
+        if (c.command == "enqueue")
+            w->addFiles(c.files);
+        else if (c.command == "play")
+            w->play();
+        else if (c.command == "stop")
+            w->stop();
+        deferred.removeFirst();
+    }
+}
+
 void Window::saveTabOrder()
 {
     // While it is possible to maintain a private string list of what tabs are
@@ -83,8 +258,8 @@ void Window::showFail(storage::storeReturns why, const QString &name, const QStr
                      : MSG_UNWRITTEN.arg(name));
     }
     if (why == storage::srNoLongerExists)
-        // ideally, we would tie a playlist to a file, and remove it when it
-        // is tampered with by hooking into inotify.
+        // the watcher in storage normally closes the tab before we get here,
+        // but it waits for the dust to settle first.
         errorMessage(MSG_NONEXISTANT.arg(name));
     if (why == storage::srRenameFailed)
         errorMessage(MSG_UNRENAMED.arg(name));
@@ -100,16 +275,116 @@ void Window::errorMessage(const QString &message)
     QMessageBox::warning(this, tr("Something bad happened"), message);
 }
 
-void Window::storage_playlistFound(const QString &name, const QStringList &entries)
+void Window::storage_playlistPending(const QString &name)
+{
+    // Placeholder tab, so the window can be shown while the playlists are
+    // still being parsed.  It stays disabled until its entries turn up.
+    addPlaceholder(name);
+}
+
+void Window::storage_playlistFound(const QString &name, int count)
 {
-    addTab(name, entries);
+    TRACE_SCOPE("Window::storage_playlistFound", name);
+    // Tabs just remember how long they are, and their entries are fetched,
+    // and looked over for missing files, once they are shown.  The tab on
+    // show already is, so it is fetched straight away.
+    int index = findTab(name);
+    if (index < 0) {
+        addPlaceholder(name, count);
+        return;
+    }
+    Widget *w = widgetAt(index);
+    if (w) {
+        // One we made ourselves, which has its entries already.
+        w->setEnabled(true);
+        return;
+    }
+    Placeholder *p = placeholderAt(index);
+    p->setCount(count);
+    if (p->isLoading())
+        return;
+    p->setEnabled(true);
+    if (index == ui->tabWidget->currentIndex())
+        requestTab(index);
+}
+
+void Window::storage_playlistUnreadable(const QString &name)
+{
+    int index = findTab(name);
+    if (index >= 0)
+        closeTab(index);
+    runDeferred();
 }
 
 void Window::storage_finishedEnumerating()
 {
+    TRACE_INSTANT("Window::storage_finishedEnumerating");
     if (ui->tabWidget->count() == 0) {
         on_addPlaylist_clicked();
     }
+    enumerated = true;
+    runDeferred();
+}
+
+void Window::storage_writeFailed(const QString &name, storage::storeReturns why)
+{
+    showFail(why, name);
+}
+
+void Window::storage_playlistChanged(const QString &name, const QStringList &entries, const QStringList &missing)
+{
+    int index = findTab(name);
+    Widget *w = widgetAt(index);
+    Placeholder *p = placeholderAt(index);
+    if (w)
+        w->mergeQueue(entries, missing);
+    else if (p && p->isEnabled())
+        p->setCount(entries.count());
+}
+
+void Window::storage_playlistVanished(const QString &name)
+{
+    // Somebody deleted or renamed the file, so the tab goes with it.  If it
+    // was renamed, the new name turns up separately as a new playlist.
+    int index = findTab(name);
+    if (index >= 0) {
+        closeTab(index);
+        saveTabOrder();
+    }
+}
+
+void Window::storage_playlistLoaded(const QString &name, const QStringList &entries, const QStringList &missing)
+{
+    TRACE_SCOPE("Window::storage_playlistLoaded", name);
+    // The tab may have been closed in the meantime.
+    int index = findTab(name);
+    Placeholder *p = placeholderAt(index);
+    if (!p || !p->isLoading())
+        return;
+    replaceTab(index, makeWidget(name, entries, missing));
+    runDeferred();
+}
+
+void Window::evictTimer_timeout()
+{
+    TRACE_SCOPE("Window::evictTimer_timeout");
+    qint64 now = uptime.elapsed();
+    for (int i = 0; i < ui->tabWidget->count(); i++) {
+        Widget *w = widgetAt(i);
+        if (!w || !w->isEnabled())
+            continue;
+        if (i == ui->tabWidget->currentIndex() || w->isBusy()) {
+            lastShown.insert(w, now);
+            continue;
+        }
+        if (now - lastShown.value(w, now) < evictAfter)
+            continue;
+        // Everything it did has gone to storage already, so there is
+        // nothing to save on the way.
+        Placeholder *p = new Placeholder(w->getTitle());
+        p->setCount(w->count());
+        replaceTab(i, p);
+    }
 }
 
 void Window::widget_playlistChanged(Widget *widget)
@@ -119,6 +394,34 @@ void Window::widget_playlistChanged(Widget *widget)
         showFail(ret, widget->getTitle());
 }
 
+void Window::widget_entriesAppended(Widget *widget, const QStringList &entries)
+{
+    storage::storeReturns ret = store.appendEntries(widget->getTitle(), entries);
+    if (ret != storage::srSuccess)
+        showFail(ret, widget->getTitle());
+}
+
+void Window::widget_entryRemoved(Widget *widget, int index)
+{
+    storage::storeReturns ret = store.removeEntry(widget->getTitle(), index);
+    if (ret != storage::srSuccess)
+        showFail(ret, widget->getTitle());
+}
+
+void Window::widget_entriesRemoved(Widget *widget, const QList<int> &indexes)
+{
+    storage::storeReturns ret = store.removeEntries(widget->getTitle(), indexes);
+    if (ret != storage::srSuccess)
+        showFail(ret, widget->getTitle());
+}
+
+void Window::widget_entryMoved(Widget *widget, int from, int to)
+{
+    storage::storeReturns ret = store.moveEntry(widget->getTitle(), from, to);
+    if (ret != storage::srSuccess)
+        showFail(ret, widget->getTitle());
+}
+
 void Window::on_addPlaylist_clicked()
 {
     QString name = tr("empty playlist");
@@ -140,6 +443,8 @@ void Window::on_tabWidget_tabBarDoubleClicked(int index)
         on_addPlaylist_clicked();
         return;
     }
+    if (!ui->tabWidget->widget(index)->isEnabled())
+        return;
 
     QString oldText = ui->tabWidget->tabText(index);
     QString newText;
@@ -154,7 +459,10 @@ void Window::on_tabWidget_tabBarDoubleClicked(int index)
         return;
     }
     ui->tabWidget->setTabText(index, newText);
-    reinterpret_cast<Widget*>(ui->tabWidget->currentWidget())->setTitle(newText);
+    if (widgetAt(index))
+        widgetAt(index)->setTitle(newText);
+    else
+        placeholderAt(index)->setTitle(newText);
 }
 
 void Window::on_removePlaylist_clicked()
@@ -183,7 +491,11 @@ void Window::on_importPlaylist_clicked()
         showFail(ret, title, fileName);
         return;
     }
-    addTab(title, entries);
+    // Checking for missing files may stall on a dead share, so it happens
+    // off the gui thread, when the tab is loaded like any other.
+    addPlaceholder(title, entries.count());
+    saveTabOrder();
+    ui->tabWidget->setCurrentIndex(ui->tabWidget->count() - 1);
 }
 
 void Window::on_exportPlaylist_clicked()
@@ -191,7 +503,9 @@ void Window::on_exportPlaylist_clicked()
     int index = ui->tabWidget->currentIndex();
     if (index < 0)
         return;
-    Widget *w = reinterpret_cast<Widget*>(ui->tabWidget->currentWidget());
+    Widget *w = widgetAt(index);
+    if (!w)
+        return;  // its entries are still on their way
     QString fileName = QFileDialog::getSaveFileName(this, tr("Save File"),
                                                     QDir::homePath(),
                                                     tr("Playlist (*.m3u)"),
@@ -213,6 +527,29 @@ void Window::on_tabWidget_tabCloseRequested(int index)
     removePlaylist(index);
 }
 
+void Window::on_tabWidget_currentChanged(int index)
+{
+    if (swapping)
+        return;
+    // The tab we are leaving starts to count as idle from now.
+    if (shown && lastShown.contains(shown))
+        lastShown.insert(shown, uptime.elapsed());
+    shown = ui->tabWidget->widget(index);
+
+    Placeholder *p = placeholderAt(index);
+    if (!p || !p->isEnabled())
+        return;  // already loaded, or still being enumerated
+    requestTab(index);
+}
+
+void Window::requestTab(int index)
+{
+    Placeholder *p = placeholderAt(index);
+    p->setLoading(true);
+    p->setEnabled(false);
+    store.requestPlaylist(p->getTitle());
+}
+
 void Window::tabWidget_tabBar_moved()
 {
     saveTabOrder();
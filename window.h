@@ -3,8 +3,14 @@
 
 #include <QWidget>
 #include <QString>
+#include <QHash>
+#include <QTimer>
+#include <QPointer>
+#include <QElapsedTimer>
 #include "storage.h"
 #include "widget.h"
+#include "placeholder.h"
+#include "scheduler.h"
 
 /* Because each playlist widget mostly manages it own playlist, the main
  * window ends up as a communicator between them and the storage backend.
@@ -14,6 +20,19 @@
  * data preservation.  So if the user deletes the config directory while
  * the program is running, it's their own stupid fault that they lost
  * their data.
+ *
+ * Tabs start out as placeholders, and only get a Widget the first time they
+ * are shown; the entries are fetched again from storage for it.  Widgets
+ * that have not been shown for window/evictAfter seconds (five minutes
+ * unless configured, zero to keep them all), and aren't playing or adding
+ * files, are put back to placeholders.  So a tab costs next to nothing until
+ * somebody actually looks at it.
+ *
+ * Playback is shared between the tabs by the scheduler, see scheduler.h.
+ *
+ * Commands from the command line, ours or forwarded from another launch
+ * (see instance.h), wait until the playlists have been enumerated, and a
+ * command for a tab that is only a placeholder waits for it to be loaded.
  */
 
 namespace Ui {
@@ -28,12 +47,45 @@ public:
     explicit Window(QWidget *parent = 0);
     ~Window();
 
+public slots:
+    void instance_commandReceived(const QString &command, const QString &playlist, const QStringList &files);
+
 private:
     Ui::Window *ui;
     storage store;
+    scheduler playback;
     QString configPath;
 
-    void addTab(const QString& title, const QStringList &queue = QStringList());
+    // When each Widget was last on screen, or last busy, on the uptime clock.
+    QElapsedTimer uptime;
+    QHash<QWidget*, qint64> lastShown;
+    QPointer<QWidget> shown;
+    QTimer evictTimer;
+    qint64 evictAfter;
+    bool swapping;
+
+    struct remoteCommand {
+        QString command;
+        QString playlist;
+        QStringList files;
+    };
+    QList<remoteCommand> deferred;
+    bool enumerated;
+    void runDeferred();
+
+    void addTab(const QString& title, const QStringList &queue = QStringList(),
+                const QStringList &missing = QStringList());
+    void addPlaceholder(const QString &title, int count = -1);
+    Widget *makeWidget(const QString& title, const QStringList &queue,
+                       const QStringList &missing);
+    void replaceTab(int index, QWidget *page);
+    // Swaps a placeholder for a Widget, once storage has its entries.
+    void requestTab(int index);
+    void closeTab(int index);
+    int findTab(const QString &title);
+    QString titleAt(int index);
+    Widget *widgetAt(int index);
+    Placeholder *placeholderAt(int index);
     void removePlaylist(int index);
     void saveTabOrder();
     void showFail(storage::storeReturns why, const QString &name, const QString &fileName = 0);
@@ -41,9 +93,20 @@ private:
 
 
 private slots:
-    void storage_playlistFound(const QString &name, const QStringList& entries);
+    void storage_playlistPending(const QString &name);
+    void storage_playlistFound(const QString &name, int count);
+    void storage_playlistUnreadable(const QString &name);
     void storage_finishedEnumerating();
+    void storage_writeFailed(const QString &name, storage::storeReturns why);
+    void storage_playlistChanged(const QString &name, const QStringList &entries, const QStringList &missing);
+    void storage_playlistVanished(const QString &name);
+    void storage_playlistLoaded(const QString &name, const QStringList &entries, const QStringList &missing);
+    void evictTimer_timeout();
     void widget_playlistChanged(Widget *widget);
+    void widget_entriesAppended(Widget *widget, const QStringList &entries);
+    void widget_entryRemoved(Widget *widget, int index);
+    void widget_entriesRemoved(Widget *widget, const QList<int> &indexes);
+    void widget_entryMoved(Widget *widget, int from, int to);
 
     void on_addPlaylist_clicked();
     void on_tabWidget_tabBarDoubleClicked(int index);
@@ -52,6 +115,7 @@ private slots:
     void on_exportPlaylist_clicked();
     void on_buttonBox_rejected();
     void on_tabWidget_tabCloseRequested(int index);
+    void on_tabWidget_currentChanged(int index);
     void tabWidget_tabBar_moved();
 
     void on_renameButton_clicked();
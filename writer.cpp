@@ -0,0 +1,192 @@
+#include "writer.h"
+#include "storage.h"
+#include "tracer.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+
+// How long to hold on to an edit, in milliseconds, in case more follow.
+static const int COALESCE_DELAY = 250;
+
+// Fold the journal back into the m3u once it reaches this size, or half the
+// size of the playlist itself, whichever is larger.  Either way the cost of
+// compacting is spread over enough edits to stay O(1) per edit.
+static const qint64 JOURNAL_COMPACT_MIN = 64 * 1024;
+
+// A write that failed is tried again after this long, doubling each time it
+// fails again, up to the maximum.  The disk is full or gone, and hammering it
+// every 250ms won't help.
+static const int RETRY_DELAY_MIN = 1000;
+static const int RETRY_DELAY_MAX = 60000;
+
+writer::writer(const storage *store) :
+    QObject(0), store(store), retryDelay(0)
+{
+    // Parented to us, so it follows us to the writer thread.
+    timer = new QTimer(this);
+    timer->setSingleShot(true);
+    timer->setInterval(COALESCE_DELAY);
+    connect(timer, SIGNAL(timeout()), SLOT(flush()));
+}
+
+qint64 writer::generation(const QString &title)
+{
+    QMutexLocker lock(&mutex);
+    if (!generations.contains(title))
+        generations.insert(title, storage::generationOfM3U(store->playlistToPath(title)));
+    return generations.value(title);
+}
+
+void writer::writePlaylist(const QString &title, const QStringList &entries)
+{
+    // A full write makes any records still waiting pointless.
+    pendingWrite &p = pending[title];
+    p.full = true;
+    p.records.clear();
+    p.entries = entries;
+    schedule();
+}
+
+void writer::appendRecords(const QString &title, const QString &records)
+{
+    pendingWrite &p = pending[title];
+    if (!p.full)
+        p.records.append(records);
+    schedule();
+}
+
+void writer::forgetPlaylist(const QString &title)
+{
+    pending.remove(title);
+    failing.remove(title);
+    QMutexLocker lock(&mutex);
+    generations.remove(title);
+}
+
+void writer::forgetGeneration(const QString &title)
+{
+    QMutexLocker lock(&mutex);
+    generations.remove(title);
+}
+
+void writer::flushPlaylist(const QString &title)
+{
+    if (pending.contains(title))
+        write(title, pending.take(title));
+}
+
+void writer::flush()
+{
+    timer->stop();
+    QHash<QString, pendingWrite> writes;
+    writes.swap(pending);
+    QHash<QString, pendingWrite>::const_iterator i;
+    for (i = writes.constBegin(); i != writes.constEnd(); ++i)
+        write(i.key(), i.value());
+
+    // Whatever failed was put back by write().
+    if (pending.isEmpty()) {
+        retryDelay = 0;
+        timer->setInterval(COALESCE_DELAY);
+        return;
+    }
+    retryDelay = retryDelay ? qMin(retryDelay * 2, RETRY_DELAY_MAX) : RETRY_DELAY_MIN;
+    timer->start(retryDelay);
+}
+
+void writer::schedule()
+{
+    if (!timer->isActive())
+        timer->start();
+}
+
+void writer::retry(const QString &title, const pendingWrite &failed)
+{
+    // Nothing can have been queued for the playlist since, as we are the
+    // only thread that takes from pending, but go by the rules anyway.
+    pendingWrite &p = pending[title];
+    if (failed.full) {
+        if (!p.full) {
+            p.full = true;
+            p.records.clear();
+            p.entries = failed.entries;
+        }
+    } else if (!p.full) {
+        p.records.prepend(failed.records);
+        p.journalSize = failed.journalSize;
+    }
+    if (!timer->isActive())
+        timer->start(retryDelay ? retryDelay : RETRY_DELAY_MIN);
+    // Saying so on every retry would only pile up dialogs while the disk
+    // stays full.
+    if (!failing.contains(title)) {
+        failing.insert(title);
+        emit writeFailed(title, storage::srWriteFailed);
+    }
+}
+
+void writer::write(const QString &title, const pendingWrite &p)
+{
+    TRACE_SCOPE("writer::write", title);
+    QString m3uPath = store->playlistToPath(title);
+    QString journalPath = store->journalToPath(title);
+    qint64 current = generation(title);
+
+    // mplaylist-cli may be writing the same playlist.
+    QLockFile lock(store->lockToPath(title));
+    if (!storage::lockPlaylist(lock)) {
+        retry(title, p);
+        return;
+    }
+
+    bool compact = p.full;
+    if (!compact) {
+        // If the last try at these records failed part way, the journal is
+        // cut back to where it was before it.
+        pendingWrite failed = p;
+        if (failed.journalSize < 0)
+            failed.journalSize = QFileInfo(journalPath).size();
+        qint64 size = storage::appendToJournal(journalPath, m3uPath, current,
+                                               failed.journalSize, p.records);
+        if (size < 0) {
+            retry(title, failed);
+            return;
+        }
+        compact = size > qMax(JOURNAL_COMPACT_MIN, QFileInfo(m3uPath).size() / 2);
+    }
+    if (!compact) {
+        failing.remove(title);
+        emit playlistWritten(title);
+        return;
+    }
+
+    // Unless we were given the whole playlist, it is read back from the m3u
+    // and the journal.  If the journal doesn't apply to the m3u any more,
+    // somebody else has been at the playlist, and that is for the next
+    // rescan to sort out, not us.
+    QStringList entries = p.entries;
+    if (!p.full) {
+        qint64 onDisk;
+        if (!storage::entriesFromM3U(m3uPath, entries, onDisk) || onDisk != current
+                || !storage::replayJournal(journalPath, m3uPath, current, entries))
+            return;
+    }
+
+    // The new m3u goes in under the next generation before the journal is
+    // removed, so the journal stops applying the moment the rename lands.
+    if (storage::commitEntriesToFile(m3uPath, entries, current + 1) != storage::srSuccess) {
+        // The records made it, so all that's left to try again is this.
+        pendingWrite compaction;
+        compaction.full = p.full;
+        compaction.entries = p.entries;
+        retry(title, compaction);
+        return;
+    }
+    {
+        QMutexLocker lock(&mutex);
+        generations.insert(title, current + 1);
+    }
+    QFile::remove(journalPath);
+    failing.remove(title);
+    emit playlistWritten(title);
+}
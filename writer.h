@@ -0,0 +1,70 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QTimer>
+
+class storage;
+
+/* Playlist writes used to happen right there on the gui thread, one full
+ * rewrite per click.  Now storage hands them to this class, which lives on a
+ * thread of its own.  Writes are held back for a moment so that a burst of
+ * edits to the same playlist becomes a single write, and full rewrites go to
+ * a temporary file that is synced and renamed over the playlist, so a crash
+ * leaves either the old playlist or the new one and never half of each.
+ *
+ * Everything here is called through queued slots, except generation(), which
+ * is safe to call from anywhere.
+ */
+
+class writer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit writer(const storage *store);
+
+    // The generation of the playlist's m3u, as far as the writer knows.
+    qint64 generation(const QString &title);
+
+signals:
+    // Once when a playlist's writes start failing, and not again until one
+    // of them has gone through.  We keep trying in between.
+    void writeFailed(const QString &title, int why);
+    // So that storage can tell our writes apart from anybody else's.
+    void playlistWritten(const QString &title);
+
+public slots:
+    void writePlaylist(const QString &title, const QStringList &entries);
+    void appendRecords(const QString &title, const QString &records);
+    void forgetPlaylist(const QString &title);
+    void forgetGeneration(const QString &title);
+    void flushPlaylist(const QString &title);
+    void flush();
+
+private:
+    struct pendingWrite {
+        pendingWrite() : full(false), journalSize(-1) {}
+        bool full;              // rewrite the m3u instead of journaling
+        QString records;        // journal records not yet on disk
+        QStringList entries;    // the whole playlist, for a full rewrite
+        qint64 journalSize;     // before records last failed to go in
+    };
+
+    const storage *store;
+    QTimer *timer;
+    int retryDelay;     // 0 unless the last write failed
+    QHash<QString, pendingWrite> pending;
+    QSet<QString> failing;  // told about, and not written since
+    QMutex mutex;   // guards generations
+    QHash<QString, qint64> generations;
+
+    void schedule();
+    void retry(const QString &title, const pendingWrite &failed);
+    void write(const QString &title, const pendingWrite &p);
+};
+
+#endif // WRITER_H